@@ -113,6 +113,18 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are valid
+   offsets within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
+{
+  check_sector (block, sector);
+  if (cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%zu, "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt,
+           block->size);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -139,6 +151,105 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   block->write_cnt++;
 }
 
+/* Reads the CNT sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it transfer all of the sectors
+   with a single command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  if (cnt == 0)
+    return;
+  check_sectors (block, sector, cnt);
+  if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    {
+      size_t i;
+
+      for (i = 0; i < cnt; i++)
+        block->ops->read (block->aux, sector + i,
+                          buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  block->read_cnt += cnt;
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+
+  if (cnt == 0)
+    return;
+  check_sectors (block, sector, cnt);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, cnt, buffer);
+  else
+    {
+      size_t i;
+
+      for (i = 0; i < cnt; i++)
+        block->ops->write (block->aux, sector + i,
+                           buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  block->write_cnt += cnt;
+}
+
+/* Starts reading the CNT sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes, and returns without waiting if the driver supports it.
+   DONE(AUX) is called once the data is in BUFFER, possibly from
+   another thread. */
+void
+block_read_async (struct block *block, block_sector_t sector, size_t cnt,
+                  void *buffer, block_done_func *done, void *aux)
+{
+  if (cnt == 0 || block->ops->read_async == NULL)
+    {
+      block_read_multiple (block, sector, cnt, buffer);
+      done (aux);
+      return;
+    }
+  check_sectors (block, sector, cnt);
+  block->ops->read_async (block->aux, sector, cnt, buffer, done, aux);
+  block->read_cnt += cnt;
+}
+
+/* Starts writing the CNT sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes, and
+   returns without waiting if the driver supports it.  BUFFER
+   must not be modified until DONE(AUX) is called, possibly from
+   another thread, after the device has acknowledged receiving
+   the data. */
+void
+block_write_async (struct block *block, block_sector_t sector, size_t cnt,
+                   const void *buffer, block_done_func *done, void *aux)
+{
+  if (cnt == 0 || block->ops->write_async == NULL)
+    {
+      block_write_multiple (block, sector, cnt, buffer);
+      done (aux);
+      return;
+    }
+  check_sectors (block, sector, cnt);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  block->ops->write_async (block->aux, sector, cnt, buffer, done, aux);
+  block->write_cnt += cnt;
+}
+
 /* Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
@@ -176,6 +287,7 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+  ide_print_stats ();
 }
 
 /* Registers a new block device with the given NAME.  If
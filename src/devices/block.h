@@ -53,9 +53,21 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous block device operations.
+   The completion function is called, with the auxiliary data
+   passed along with it, once the transfer has finished. */
+typedef void block_done_func (void *aux);
+void block_read_async (struct block *, block_sector_t, size_t cnt, void *,
+                       block_done_func *, void *aux);
+void block_write_async (struct block *, block_sector_t, size_t cnt,
+                        const void *, block_done_func *, void *aux);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,6 +77,24 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors at once.  If
+       null, the block layer calls read or write once per
+       sector instead. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Optional.  Start transferring CNT consecutive sectors and
+       return without waiting, calling DONE(DONE_AUX) when
+       finished.  If null, the block layer transfers the sectors
+       before returning and then calls DONE itself. */
+    void (*read_async) (void *aux, block_sector_t, size_t cnt, void *buffer,
+                        block_done_func *done, void *done_aux);
+    void (*write_async) (void *aux, block_sector_t, size_t cnt,
+                         const void *buffer,
+                         block_done_func *done, void *done_aux);
   };
 
 struct block *block_register (const char *name, enum block_type,
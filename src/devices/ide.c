@@ -1,6 +1,7 @@
 #include "devices/ide.h"
 #include <ctype.h>
 #include <debug.h>
+#include <list.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/block.h"
@@ -8,7 +9,9 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +37,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +53,16 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+
+/* Most sectors transferred by a single READ or WRITE command.
+   The sector count register holds 8 bits, with 0 meaning 256. */
+#define MAX_XFER_SECTORS 256
+
+/* Most queued requests merged into a single disk command. */
+#define MAX_MERGE 32
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +71,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int mult_sectors;           /* Sectors per interrupt in READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
+    struct block *block;        /* Registered block device, or null. */
   };
 
 /* An ATA channel (aka controller).
@@ -67,12 +84,43 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
+
+    /* Request queue.  Disks are identified before the channel's
+       I/O thread starts; from then on, only it touches the
+       controller. */
+    struct lock lock;           /* Protects the members below. */
+    struct list queue;          /* Pending requests, in sector order. */
+    struct condition queue_ready;       /* Signaled when queue is
+                                           nonempty. */
+    block_sector_t head;        /* Sector following the last transfer. */
+
+    /* Statistics. */
+    unsigned long long request_cnt;     /* Requests submitted. */
+    unsigned long long merge_cnt;       /* Requests merged into another's
+                                           command. */
+    unsigned long long command_cnt;     /* Commands issued. */
+    unsigned long long depth_sum;       /* Sum of queue depths at submit. */
+    unsigned long long seek_sum;        /* Sum of sector distances seeked. */
+    size_t max_depth;                   /* Deepest queue seen. */
+  };
+
+/* A disk request waiting in a channel's queue. */
+struct ide_request
+  {
+    struct list_elem elem;      /* Element in channel's queue. */
+    struct ata_disk *disk;      /* Disk to access. */
+    bool write;                 /* True to write, false to read. */
+    block_sector_t sec_no;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    uint8_t *buffer;            /* CNT * BLOCK_SECTOR_SIZE bytes of data. */
+    block_done_func *done;      /* Called when the transfer completes. */
+    void *aux;                  /* Passed to DONE. */
+    bool free_when_done;        /* Allocated by submit()? */
   };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
@@ -84,8 +132,9 @@ static struct block_operations ide_operations;
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, int max_sectors);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -97,6 +146,17 @@ static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
+static void submit (struct ide_request *);
+static void submit_async (struct ata_disk *, bool write, block_sector_t,
+                          size_t cnt, void *buffer,
+                          block_done_func *, void *aux);
+static void submit_sync (struct ata_disk *, bool write, block_sector_t,
+                         size_t cnt, void *buffer);
+static thread_func io_thread NO_RETURN;
+static size_t next_batch (struct channel *, struct ide_request *batch[]);
+static void transfer (struct channel *, struct ide_request *batch[],
+                      size_t cnt);
+
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
@@ -123,9 +183,15 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      lock_init (&c->lock);
+      list_init (&c->queue);
+      cond_init (&c->queue_ready);
+      c->head = 0;
+      c->request_cnt = c->merge_cnt = c->command_cnt = 0;
+      c->depth_sum = c->seek_sum = 0;
+      c->max_depth = 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +202,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->mult_sectors = 0;
+          d->block = NULL;
         }
 
       /* Register interrupt handler. */
@@ -152,8 +220,38 @@ ide_init (void)
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
           identify_ata_device (&c->devices[dev_no]);
+
+      /* Start servicing the request queue.  The I/O thread gets
+         no priority donation from the threads whose requests it
+         serves, so it runs at the highest priority: otherwise any
+         thread above its priority would starve the disk for all
+         threads.  It blocks except while issuing commands and
+         completing requests. */
+      if (thread_create (c->name, PRI_MAX, io_thread, c) == TID_ERROR)
+        PANIC ("%s: can't start I/O thread", c->name);
+
+      /* Read partition tables, through the queue. */
+      for (dev_no = 0; dev_no < 2; dev_no++)
+        if (c->devices[dev_no].block != NULL)
+          partition_scan (c->devices[dev_no].block);
     }
 }
+
+/* Prints request queue statistics for each channel that has
+   serviced requests. */
+void
+ide_print_stats (void)
+{
+  struct channel *c;
+
+  for (c = channels; c < channels + CHANNEL_CNT; c++)
+    if (c->request_cnt > 0)
+      printf ("%s: %llu requests, %llu merged, %llu commands, "
+              "avg queue depth %llu, max %zu, avg seek %llu sectors\n",
+              c->name, c->request_cnt, c->merge_cnt, c->command_cnt,
+              c->depth_sum / c->request_cnt, c->max_depth,
+              c->command_cnt > 0 ? c->seek_sum / c->command_cnt : 0);
+}
 
 /* Disk detection and identification. */
 
@@ -254,8 +352,10 @@ check_device_type (struct ata_disk *d)
 }
 
 /* Sends an IDENTIFY DEVICE command to disk D and reads the
-   response.  Registers the disk with the block device
-   layer. */
+   response.  Registers the disk with the block device layer,
+   without reading from it yet.  Programs the controller
+   directly, so it must be called before the channel's I/O
+   thread starts. */
 static void
 identify_ata_device (struct ata_disk *d) 
 {
@@ -264,8 +364,6 @@ identify_ata_device (struct ata_disk *d)
   block_sector_t capacity;
   char *model, *serial;
   char extra_info[128];
-  struct block *block;
-
   ASSERT (d->is_ata);
 
   /* Send the IDENTIFY DEVICE command, wait for an interrupt
@@ -303,10 +401,35 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Word 47 gives the largest number of sectors the disk can
+     transfer per interrupt with READ/WRITE MULTIPLE. */
+  set_multiple_mode (d, *(uint16_t *) &id[47 * 2] & 0xff);
+
   /* Register. */
-  block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
-                          &ide_operations, d);
-  partition_scan (block);
+  d->block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
+                             &ide_operations, d);
+}
+
+/* Enables READ/WRITE MULTIPLE on disk D with up to MAX_SECTORS
+   sectors per interrupt.  Leaves D using single-sector
+   transfers if MAX_SECTORS is 0 or the disk rejects the
+   command.  Like identify_ata_device(), must be called before
+   the channel's I/O thread starts. */
+static void
+set_multiple_mode (struct ata_disk *d, int max_sectors)
+{
+  struct channel *c = d->channel;
+
+  if (max_sectors == 0)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), max_sectors);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->mult_sectors = max_sectors;
 }
 
 /* Translates STRING, which consists of SIZE bytes in a funky
@@ -337,6 +460,29 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Returns after the data has been read.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt, void *buffer)
+{
+  submit_sync (d_, false, sec_no, cnt, buffer);
+}
+
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer)
+{
+  submit_sync (d_, true, sec_no, cnt, (void *) buffer);
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
@@ -344,16 +490,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  submit_sync (d_, false, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -364,36 +501,297 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  submit_sync (d_, true, sec_no, 1, (void *) buffer);
+}
+
+/* Queues a read of the CNT sectors starting at SEC_NO from disk
+   D into BUFFER and returns immediately.  DONE(AUX) is called
+   from the channel's I/O thread once the data is in BUFFER. */
+static void
+ide_read_async (void *d_, block_sector_t sec_no, size_t cnt, void *buffer,
+                block_done_func *done, void *aux)
+{
+  submit_async (d_, false, sec_no, cnt, buffer, done, aux);
+}
+
+/* Queues a write of the CNT sectors starting at SEC_NO to disk D
+   from BUFFER and returns immediately.  BUFFER must not be
+   modified until DONE(AUX) is called from the channel's I/O
+   thread. */
+static void
+ide_write_async (void *d_, block_sector_t sec_no, size_t cnt,
+                 const void *buffer, block_done_func *done, void *aux)
+{
+  submit_async (d_, true, sec_no, cnt, (void *) buffer, done, aux);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    ide_read_async,
+    ide_write_async
   };
 
+/* Request queue. */
+
+/* Returns true if request A precedes request B in sector
+   order. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct ide_request *a = list_entry (a_, struct ide_request, elem);
+  const struct ide_request *b = list_entry (b_, struct ide_request, elem);
+
+  return a->sec_no < b->sec_no;
+}
+
+/* Adds R to its channel's queue and wakes the channel's I/O
+   thread.  Requests for the same sector are serviced in the
+   order submitted. */
+static void
+submit (struct ide_request *r)
+{
+  struct channel *c = r->disk->channel;
+  size_t depth;
+
+  ASSERT (r->cnt > 0);
+
+  lock_acquire (&c->lock);
+  list_insert_ordered (&c->queue, &r->elem, request_less, NULL);
+  depth = list_size (&c->queue);
+  c->request_cnt++;
+  c->depth_sum += depth;
+  if (depth > c->max_depth)
+    c->max_depth = depth;
+  cond_signal (&c->queue_ready, &c->lock);
+  lock_release (&c->lock);
+}
+
+/* Queues a transfer of CNT sectors between disk D, starting at
+   SEC_NO, and BUFFER, and returns without waiting for it.
+   DONE(AUX) is called when the transfer completes.  If there is
+   no memory for the request, performs the transfer before
+   returning. */
+static void
+submit_async (struct ata_disk *d, bool write, block_sector_t sec_no,
+              size_t cnt, void *buffer, block_done_func *done, void *aux)
+{
+  struct ide_request *r = malloc (sizeof *r);
+  if (r == NULL)
+    {
+      submit_sync (d, write, sec_no, cnt, buffer);
+      done (aux);
+      return;
+    }
+
+  r->disk = d;
+  r->write = write;
+  r->sec_no = sec_no;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->done = done;
+  r->aux = aux;
+  r->free_when_done = true;
+  submit (r);
+}
+
+/* Completion function for submit_sync(). */
+static void
+wake_submitter (void *sema)
+{
+  sema_up (sema);
+}
+
+/* Transfers CNT sectors between disk D, starting at SEC_NO, and
+   BUFFER through the channel's queue, and waits for the
+   transfer to complete. */
+static void
+submit_sync (struct ata_disk *d, bool write, block_sector_t sec_no,
+             size_t cnt, void *buffer)
+{
+  struct ide_request r;
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  r.disk = d;
+  r.write = write;
+  r.sec_no = sec_no;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.done = wake_submitter;
+  r.aux = &done;
+  r.free_when_done = false;
+  submit (&r);
+  sema_down (&done);
+}
+
+/* Services channel C's request queue.  Requests are taken in
+   C-LOOK order: ascending sector numbers from the position of
+   the last transfer, then back to the lowest pending sector.
+   Requests that continue where the previous one ends are merged
+   into a single command. */
+static void
+io_thread (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      struct ide_request *batch[MAX_MERGE];
+      size_t cnt = next_batch (c, batch);
+      size_t i;
+
+      transfer (c, batch, cnt);
+      for (i = 0; i < cnt; i++)
+        {
+          struct ide_request *r = batch[i];
+          bool free_when_done = r->free_when_done;
+
+          /* R may cease to exist as soon as DONE is called. */
+          r->done (r->aux);
+          if (free_when_done)
+            free (r);
+        }
+    }
+}
+
+/* Waits for channel C's queue to become nonempty, then removes
+   the next request in C-LOOK order and any queued requests that
+   can be merged with it, and stores them in BATCH in sector
+   order.  Returns the number of requests stored. */
+static size_t
+next_batch (struct channel *c, struct ide_request *batch[])
+{
+  struct ide_request *r;
+  struct list_elem *e;
+  block_sector_t end;
+  size_t sectors;
+  size_t cnt;
+
+  lock_acquire (&c->lock);
+  while (list_empty (&c->queue))
+    cond_wait (&c->queue_ready, &c->lock);
+
+  /* First request at or beyond the head, wrapping around to the
+     lowest sector if there is none. */
+  for (e = list_begin (&c->queue); e != list_end (&c->queue);
+       e = list_next (e))
+    if (list_entry (e, struct ide_request, elem)->sec_no >= c->head)
+      break;
+  if (e == list_end (&c->queue))
+    e = list_begin (&c->queue);
+  r = list_entry (e, struct ide_request, elem);
+
+  c->seek_sum += (r->sec_no >= c->head
+                  ? r->sec_no - c->head : c->head - r->sec_no);
+  c->command_cnt++;
+
+  /* Take R and the requests that follow it contiguously on the
+     same disk in the same direction. */
+  cnt = 0;
+  sectors = 0;
+  end = r->sec_no;
+  while (e != list_end (&c->queue) && cnt < MAX_MERGE)
+    {
+      struct ide_request *next = list_entry (e, struct ide_request, elem);
+      if (next->disk != r->disk || next->write != r->write
+          || next->sec_no != end
+          || sectors + next->cnt > MAX_XFER_SECTORS)
+        break;
+
+      e = list_remove (e);
+      batch[cnt++] = next;
+      sectors += next->cnt;
+      end += next->cnt;
+    }
+  c->merge_cnt += cnt - 1;
+  c->head = end;
+  lock_release (&c->lock);
+
+  return cnt;
+}
+
+/* Transfers the CNT requests in BATCH, which must be for
+   consecutive sectors on the same disk in the same direction,
+   with a single READ or WRITE command.  With READ/WRITE MULTIPLE
+   enabled the disk interrupts once per mult_sectors sectors
+   instead of once per sector. */
+static void
+transfer (struct channel *c, struct ide_request *batch[], size_t cnt)
+{
+  struct ata_disk *d = batch[0]->disk;
+  bool write = batch[0]->write;
+  block_sector_t sec_no = batch[0]->sec_no;
+  size_t per_intr = d->mult_sectors > 0 ? (size_t) d->mult_sectors : 1;
+  size_t total, left;
+  size_t req_idx, req_ofs;
+  uint8_t command;
+  size_t i;
+
+  total = 0;
+  for (i = 0; i < cnt; i++)
+    total += batch[i]->cnt;
+
+  if (write)
+    command = d->mult_sectors > 0 ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY;
+  else
+    command = d->mult_sectors > 0 ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY;
+  select_sector (d, sec_no, total);
+  issue_pio_command (c, command);
+
+  /* REQ_IDX and REQ_OFS track the request and sector within it
+     that the next sector transferred belongs to. */
+  req_idx = req_ofs = 0;
+  for (left = total; left > 0; )
+    {
+      size_t block_cnt = left < per_intr ? left : per_intr;
+
+      /* A read interrupts when each block is ready to be read; a
+         write interrupts after each block has been written. */
+      if (!write)
+        sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+               write ? "write" : "read", sec_no + (total - left));
+
+      for (i = 0; i < block_cnt; i++)
+        {
+          struct ide_request *r = batch[req_idx];
+          uint8_t *sector = r->buffer + req_ofs * BLOCK_SECTOR_SIZE;
+
+          if (write)
+            output_sector (c, sector);
+          else
+            input_sector (c, sector);
+          if (++req_ofs == r->cnt)
+            {
+              req_idx++;
+              req_ofs = 0;
+            }
+        }
+      if (write)
+        sema_down (&c->completion_wait);
+      left -= block_cnt;
+    }
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number CNT of sectors to transfer to
+   the disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_XFER_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_XFER_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
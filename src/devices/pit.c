@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,42 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Configures channel CHANNEL in the PIT to count down COUNT PIT
+   cycles once and then raise its output, which for channel 0
+   raises a single timer interrupt.  This is mode 0, "interrupt
+   on terminal count".  COUNT must be between 1 and
+   PIT_MAX_COUNT. */
+void
+pit_configure_oneshot (int channel, unsigned count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+  ASSERT (count >= 1 && count <= PIT_MAX_COUNT);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the current value of CHANNEL's counter, which counts
+   down once per PIT cycle. */
+unsigned
+pit_read_count (int channel)
+{
+  enum intr_level old_level;
+  unsigned count;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  /* Latch the counter, then read its low and high bytes. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, channel << 6);
+  count = inb (PIT_PORT_COUNTER (channel));
+  count |= inb (PIT_PORT_COUNTER (channel)) << 8;
+  intr_set_level (old_level);
+  return count;
+}
@@ -3,6 +3,14 @@
 
 #include <stdint.h>
 
+/* PIT cycles per second. */
+#define PIT_HZ 1193180
+
+/* Largest count that a PIT channel can be loaded with. */
+#define PIT_MAX_COUNT 65535
+
 void pit_configure_channel (int channel, int mode, int frequency);
+void pit_configure_oneshot (int channel, unsigned count);
+unsigned pit_read_count (int channel);
 
 #endif /* devices/pit.h */
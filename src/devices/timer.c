@@ -20,11 +20,89 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Sequence count for ticks and the clock below.  The timer
+   interrupt handler increments it before and after it updates
+   them, so that it is odd during an update.  Readers need not
+   disable interrupts: they retry if the count was odd or changed
+   while they read. */
+static unsigned ticks_seq;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Nanosecond clock, driven by the CPU's time-stamp counter.
+   The time is clock_ns + ((TSC - clock_tsc) * tsc_mult
+   + clock_frac) / 2**TSC_SHIFT nanoseconds.  The timer interrupt
+   handler advances clock_tsc to the current TSC at each
+   interrupt, so that the product cannot overflow.  The product
+   is about 2**TSC_SHIFT times the nanoseconds elapsed, whatever
+   the TSC rate, so it takes more than 1000 seconds without an
+   interrupt to overflow it.
+
+   tsc_mult needs 64 bits: a TSC slower than about 3.9 MHz, as
+   under Bochs with a low instruction rate, has more than 2**8
+   ns per cycle. */
+static uint64_t tsc_hz;         /* TSC cycles per second. */
+static uint64_t tsc_mult;       /* ns per TSC cycle, times 2**TSC_SHIFT. */
+static int64_t clock_ns;        /* Nanoseconds at clock_tsc. */
+static uint64_t clock_tsc;      /* TSC at last update. */
+static uint64_t clock_frac;     /* Fraction of a nanosecond, times
+                                   2**TSC_SHIFT. */
+#define TSC_SHIFT 24
+
+/* Nanoseconds per timer tick. */
+#define NS_PER_TICK (1000 * 1000 * 1000 / TIMER_FREQ)
+
+/* Number of timer ticks over which the time-stamp counter is
+   calibrated against the PIT. */
+#define TSC_CALIBRATE_TICKS 10
+
+/* Tickless idle.  If true (set by the "-tickless" kernel
+   command-line option), then when only the idle thread can run,
+   the periodic timer interrupt is replaced by a one-shot
+   interrupt at the next tick on which there is work to do, such
+   as waking a sleeping thread.  The 16-bit PIT counter limits
+   this to about 5 ticks at a time at 100 Hz.  The ticks skipped
+   are counted when the one-shot fires, or, if some other
+   interrupt makes a thread runnable first, when the idle thread
+   is switched out. */
+bool timer_tickless;
+
+/* PIT cycles per timer tick. */
+#define PIT_TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* PIT channel 0 is not reprogrammed when it is due to interrupt
+   within this many PIT cycles (about 50 us), because it might
+   interrupt before the new count takes effect. */
+#define PIT_SLACK 64
+
+/* State of PIT channel 0.  Normally it interrupts periodically,
+   once per tick.  To end an idle period of several ticks, or to
+   expire a high-resolution timer between ticks, it is instead
+   programmed to interrupt once, after oneshot_count PIT cycles.
+   A one-shot interrupt comes either before the first tick after
+   it is programmed or exactly on a tick. */
+static bool oneshot;            /* Programmed for a one-shot? */
+static unsigned oneshot_count;  /* PIT cycles it was programmed for. */
+static unsigned oneshot_first;  /* PIT cycles to the first tick. */
+
+/* Pending high-resolution timers, soonest first. */
+static struct list hrtimers;
+
+/* True while timer_interrupt() is running.  It programs the PIT
+   itself after expiring high-resolution timers. */
+static bool in_timer_interrupt;
+
 static intr_handler_func timer_interrupt;
+static void advance_ticks (int64_t cnt);
+static list_less_func hrtimer_less;
+static unsigned sync_ticks (void);
+static void program_timer (unsigned next, bool idle);
+static void run_hrtimers (void);
+static uint64_t rdtsc (void);
+static unsigned ns_to_pit (int64_t ns);
+static void hrtimer_sleep (int64_t ns);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -39,13 +117,19 @@ timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+  list_init (&hrtimers);
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates loops_per_tick, used to implement brief delays,
+   and the rate of the time-stamp counter, used by timer_now_ns()
+   and high-resolution timers. */
 void
 timer_calibrate (void) 
 {
   unsigned high_bit, test_bit;
+  enum intr_level old_level;
+  int64_t start;
+  uint64_t tsc;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
@@ -65,19 +149,78 @@ timer_calibrate (void)
     if (!too_many_loops (high_bit | test_bit))
       loops_per_tick |= test_bit;
 
-  printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+  /* Count time-stamp counter cycles over several ticks, each
+     of which is PIT_TICK_COUNT cycles of the PIT. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+  tsc = rdtsc ();
+  start = ticks;
+  while (ticks < start + TSC_CALIBRATE_TICKS)
+    barrier ();
+  tsc = rdtsc () - tsc;
+
+  /* Start the nanosecond clock from the current tick count. */
+  old_level = intr_disable ();
+  ticks_seq++;
+  barrier ();
+  tsc_hz = tsc * PIT_HZ / (TSC_CALIBRATE_TICKS * PIT_TICK_COUNT);
+  ASSERT (tsc_hz > 0);
+  tsc_mult = ((uint64_t) 1000 * 1000 * 1000 << TSC_SHIFT) / tsc_hz;
+  ASSERT (tsc_mult > 0);
+  clock_ns = ticks * NS_PER_TICK;
+  clock_tsc = rdtsc ();
+  clock_frac = 0;
+  barrier ();
+  ticks_seq++;
+  intr_set_level (old_level);
+
+  printf ("%'"PRIu64" loops/s, %'"PRIu64" TSC cycles/s.\n",
+          (uint64_t) loops_per_tick * TIMER_FREQ, tsc_hz);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
 int64_t
 timer_ticks (void) 
 {
-  enum intr_level old_level = intr_disable ();
-  int64_t t = ticks;
-  intr_set_level (old_level);
+  unsigned seq;
+  int64_t t;
+
+  do
+    {
+      seq = ticks_seq;
+      barrier ();
+      t = ticks;
+      barrier ();
+    }
+  while ((seq & 1) != 0 || seq != ticks_seq);
   return t;
 }
 
+/* Returns the number of nanoseconds since the OS booted.  Before
+   timer_calibrate() has run, this has only tick resolution.  May
+   be called from any context, with interrupts on or off. */
+int64_t
+timer_now_ns (void)
+{
+  unsigned seq;
+  int64_t ns;
+
+  do
+    {
+      seq = ticks_seq;
+      barrier ();
+      if (tsc_mult != 0)
+        ns = clock_ns + (((rdtsc () - clock_tsc) * tsc_mult + clock_frac)
+                         >> TSC_SHIFT);
+      else
+        ns = ticks * NS_PER_TICK;
+      barrier ();
+    }
+  while ((seq & 1) != 0 || seq != ticks_seq);
+  return ns;
+}
+
 /* Returns the number of timer ticks elapsed since THEN, which
    should be a value once returned by timer_ticks(). */
 int64_t
@@ -174,12 +317,302 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Arranges for FUNC to be called with AUX as its argument,
+   from the timer interrupt handler, NS nanoseconds from now.
+   T must not already be pending.  Requires timer_calibrate() to
+   have run. */
+void
+hrtimer_start (struct hrtimer *t, int64_t ns, hrtimer_func *func, void *aux)
+{
+  enum intr_level old_level;
+
+  ASSERT (t != NULL);
+  ASSERT (func != NULL);
+  ASSERT (tsc_mult != 0);
+
+  old_level = intr_disable ();
+  ASSERT (!t->pending);
+  t->expires = timer_now_ns () + (ns > 0 ? ns : 0);
+  t->func = func;
+  t->aux = aux;
+  t->pending = true;
+  list_insert_ordered (&hrtimers, &t->elem, hrtimer_less, NULL);
+
+  /* If T is now the soonest timer, it may need an earlier
+     interrupt than the one the PIT is programmed for. */
+  if (!in_timer_interrupt && list_front (&hrtimers) == &t->elem)
+    {
+      unsigned next = sync_ticks ();
+      if (next > 0)
+        program_timer (next, false);
+    }
+  intr_set_level (old_level);
+}
+
+/* Cancels T if it is pending.  Returns true if T was pending,
+   false if it had already expired or was never started. */
+bool
+hrtimer_cancel (struct hrtimer *t)
+{
+  enum intr_level old_level = intr_disable ();
+  bool was_pending = t->pending;
+
+  if (was_pending)
+    {
+      list_remove (&t->elem);
+      t->pending = false;
+    }
+  intr_set_level (old_level);
+  return was_pending;
+}
+
+/* Returns true if high-resolution timer A expires before B. */
+static bool
+hrtimer_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct hrtimer *a = list_entry (a_, struct hrtimer, elem);
+  const struct hrtimer *b = list_entry (b_, struct hrtimer, elem);
+
+  return a->expires < b->expires;
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU to wait for an interrupt.  In tickless mode,
+   replaces the periodic timer interrupt by a one-shot interrupt
+   at the next tick on which there is work to do. */
+void
+timer_idle_enter (void)
+{
+  unsigned next;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless)
+    return;
+  next = sync_ticks ();
+  if (next > 0)
+    program_timer (next, true);
+}
+
+/* Called when the idle thread is switched out, with interrupts
+   off.  If ticks are being skipped, counts the ones that have
+   already passed and programs the timer to interrupt on the next
+   one, after which it is periodic again. */
+void
+timer_idle_exit (void)
+{
+  unsigned next;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!oneshot || oneshot_count <= oneshot_first)
+    return;
+  next = sync_ticks ();
+  if (next > 0)
+    program_timer (next, false);
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
-  thread_tick ();
+  unsigned passed, next;
+
+  if (oneshot)
+    {
+      /* Count the ticks that passed during the one-shot.  All
+         but the last were skipped while idle.  The one-shot may
+         have ended between ticks, for a high-resolution timer, so
+         schedule the next tick on the original tick grid. */
+      passed = (oneshot_count < oneshot_first ? 0
+                : 1 + (oneshot_count - oneshot_first) / PIT_TICK_COUNT);
+      next = oneshot_first + passed * PIT_TICK_COUNT - oneshot_count;
+      if (passed > 1)
+        thread_tick_idle (passed - 1);
+    }
+  else
+    {
+      passed = 1;
+      next = PIT_TICK_COUNT;
+    }
+
+  advance_ticks (passed);
+  if (passed > 0)
+    thread_tick ();
+
+  in_timer_interrupt = true;
+  run_hrtimers ();
+  in_timer_interrupt = false;
+  program_timer (next, false);
+}
+
+/* Adds CNT to the tick count and brings the nanosecond clock up
+   to date. */
+static void
+advance_ticks (int64_t cnt)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  ticks_seq++;
+  barrier ();
+  ticks += cnt;
+  if (tsc_mult != 0)
+    {
+      uint64_t now = rdtsc ();
+      uint64_t acc = (now - clock_tsc) * tsc_mult + clock_frac;
+
+      clock_ns += acc >> TSC_SHIFT;
+      clock_frac = acc & ((1u << TSC_SHIFT) - 1);
+      clock_tsc = now;
+    }
+  barrier ();
+  ticks_seq++;
+}
+
+/* Accounts for any ticks that have passed without a timer
+   interrupt during a one-shot, and returns the number of PIT
+   cycles until the next tick.  Returns 0 if a timer interrupt is
+   pending or about to be, in which case timer_interrupt() will
+   program the PIT instead.  The caller must call
+   program_timer() if the return value is nonzero. */
+static unsigned
+sync_ticks (void)
+{
+  unsigned count, elapsed, passed;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  count = pit_read_count (0);
+  if (count < PIT_SLACK || intr_is_pending (0x20))
+    return 0;
+  if (!oneshot)
+    return count;
+
+  elapsed = oneshot_count - count;
+  passed = (elapsed < oneshot_first ? 0
+            : 1 + (elapsed - oneshot_first) / PIT_TICK_COUNT);
+  advance_ticks (passed);
+  thread_tick_idle (passed);
+  return oneshot_first + passed * PIT_TICK_COUNT - elapsed;
+}
+
+/* Programs PIT channel 0 to interrupt on the next tick, NEXT PIT
+   cycles from now, or earlier if a high-resolution timer expires
+   sooner.  If IDLE is true and tickless idle is enabled, the
+   interrupt may instead be put off until a later tick on which
+   there is work to do. */
+static void
+program_timer (unsigned next, bool idle)
+{
+  unsigned count = next;
+  int64_t tick_cnt = 1;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (next > 0 && next <= PIT_TICK_COUNT);
+
+  if (idle && timer_tickless)
+    {
+      tick_cnt = thread_ticks_until_work (1 + (PIT_MAX_COUNT - next)
+                                          / PIT_TICK_COUNT);
+      count = next + (tick_cnt - 1) * PIT_TICK_COUNT;
+    }
+  if (!list_empty (&hrtimers))
+    {
+      struct hrtimer *t = list_entry (list_front (&hrtimers),
+                                      struct hrtimer, elem);
+      unsigned until = ns_to_pit (t->expires - timer_now_ns ());
+      if (until < count)
+        count = until;
+    }
+
+  if (count == next)
+    {
+      /* Nothing to do before the next tick.  If we are on a tick
+         now, go back to periodic interrupts. */
+      if (!oneshot)
+        return;
+      if (next == PIT_TICK_COUNT)
+        {
+          oneshot = false;
+          pit_configure_channel (0, 2, TIMER_FREQ);
+          return;
+        }
+    }
+
+  oneshot = true;
+  oneshot_count = count;
+  oneshot_first = next;
+  pit_configure_oneshot (0, count);
+}
+
+/* Calls the functions of high-resolution timers that have
+   expired. */
+static void
+run_hrtimers (void)
+{
+  int64_t now = timer_now_ns ();
+
+  while (!list_empty (&hrtimers))
+    {
+      struct hrtimer *t = list_entry (list_front (&hrtimers),
+                                      struct hrtimer, elem);
+      if (t->expires > now)
+        break;
+      list_pop_front (&hrtimers);
+      t->pending = false;
+      t->func (t->aux);
+    }
+}
+
+/* Returns the current value of the CPU's time-stamp counter. */
+static uint64_t
+rdtsc (void)
+{
+  /* See [IA32-v2b] "RDTSC". */
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Converts NS nanoseconds to PIT cycles, rounding up, but to at
+   least 1 and at most PIT_MAX_COUNT. */
+static unsigned
+ns_to_pit (int64_t ns)
+{
+  int64_t pit;
+
+  if (ns <= 0)
+    return 1;
+  if (ns >= (int64_t) NS_PER_TICK * (PIT_MAX_COUNT / PIT_TICK_COUNT + 1))
+    return PIT_MAX_COUNT;
+  pit = (ns * PIT_HZ + 1000 * 1000 * 1000 - 1) / (1000 * 1000 * 1000);
+  return pit < PIT_MAX_COUNT ? pit : PIT_MAX_COUNT;
+}
+
+/* Called from the timer interrupt handler when a sleeping
+   thread's high-resolution timer expires. */
+static void
+wake_sleeper (void *done)
+{
+  sema_up (done);
+}
+
+/* Blocks the current thread for NS nanoseconds, which should be
+   less than one timer tick, using a high-resolution timer. */
+static void
+hrtimer_sleep (int64_t ns)
+{
+  struct hrtimer t;
+  struct semaphore done;
+
+  if (ns <= 0)
+    return;
+
+  t.pending = false;
+  sema_init (&done, 0);
+  hrtimer_start (&t, ns, wake_sleeper, &done);
+  sema_down (&done);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -235,10 +668,17 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
+  else if (tsc_mult != 0)
+    {
+      /* Otherwise, block on a high-resolution timer for more
+         accurate sub-tick timing. */
+      ASSERT (1000 * 1000 * 1000 % denom == 0);
+      hrtimer_sleep (num * (1000 * 1000 * 1000 / denom));
+    }
   else 
     {
-      /* Otherwise, use a busy-wait loop for more accurate
-         sub-tick timing. */
+      /* The high-resolution timer is not calibrated yet.  Use a
+         busy-wait loop. */
       real_time_delay (num, denom); 
     }
 }
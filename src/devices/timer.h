@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -12,6 +14,7 @@ void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+int64_t timer_now_ns (void);
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
@@ -26,4 +29,28 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* High-resolution timers. */
+typedef void hrtimer_func (void *aux);
+
+/* A one-shot timer that calls FUNC from the timer interrupt
+   handler at a given time, with much finer resolution than a
+   timer tick.  Initialize PENDING to false before first use. */
+struct hrtimer
+  {
+    struct list_elem elem;      /* Element in list of pending timers. */
+    int64_t expires;            /* timer_now_ns() value to expire at. */
+    hrtimer_func *func;         /* Function to call. */
+    void *aux;                  /* Auxiliary data for FUNC. */
+    bool pending;               /* Started and not yet expired? */
+  };
+
+void hrtimer_start (struct hrtimer *, int64_t nanoseconds,
+                    hrtimer_func *, void *aux);
+bool hrtimer_cancel (struct hrtimer *);
+
+/* Tickless idle. */
+extern bool timer_tickless;
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 #endif /* devices/timer.h */
@@ -0,0 +1,475 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Timer ticks between write-behind passes of the flush daemon. */
+#define FLUSH_INTERVAL TIMER_FREQ
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, if in_use. */
+    bool in_use;                        /* Does this entry hold a sector? */
+    bool dirty;                         /* Modified since last written? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    bool writing_back;                  /* Writing back old_sector?  Set
+                                           under cache_lock, cleared
+                                           without it. */
+    block_sector_t old_sector;          /* Sector evicted from the entry. */
+    struct lock lock;                   /* Protects the members above
+                                           and data. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+/* The buffer cache. */
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Protects the mapping from sectors to entries and the clock
+   hand.  Must be acquired before any entry's lock, never
+   after. */
+static struct lock cache_lock;
+static struct lock_stats cache_lock_stats;
+
+/* Next entry to be considered for eviction. */
+static size_t clock_hand;
+
+/* Threads in evict(), protected by cache_lock.  Read without the
+   lock by unlock_entry(), which is safe because evict() counts
+   itself before it looks for an unlocked entry. */
+static int evict_waiters;
+
+/* Signaled when an entry is unlocked while evict_waiters is
+   nonzero. */
+static struct condition entry_unlocked;
+
+/* Sectors waiting to be fetched by the read-ahead daemon, as a
+   ring buffer.  Requests that arrive while it is full are
+   dropped. */
+#define READ_AHEAD_CNT 32
+
+/* Most consecutive sectors the read-ahead daemon fetches with a
+   single disk request. */
+#define READ_AHEAD_RUN 16
+
+static block_sector_t read_ahead_queue[READ_AHEAD_CNT];
+static size_t read_ahead_head;          /* Index of oldest request. */
+static size_t read_ahead_cnt;           /* Number of requests queued. */
+static struct lock read_ahead_lock;     /* Protects the queue. */
+static struct condition read_ahead_ready; /* Signaled when queue
+                                             becomes nonempty. */
+
+/* Set by cache_done() to make the daemons exit. */
+static bool stopping;
+
+static thread_func flush_daemon;
+static thread_func read_ahead_daemon;
+static struct cache_entry *cache_get (block_sector_t, bool need_read);
+static struct cache_entry *lookup (block_sector_t);
+static struct cache_entry *evict (block_sector_t);
+static void write_back (struct cache_entry *);
+static void unlock_entry (struct cache_entry *);
+static void read_ahead_run (block_sector_t, size_t cnt);
+
+/* Initializes the buffer cache and starts the daemons that
+   periodically write dirty sectors back to disk and that read
+   sectors ahead of sequential readers. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  lock_stats_init (&cache_lock_stats, "buffer cache");
+  lock_set_stats (&cache_lock, &cache_lock_stats);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      lock_init (&cache[i].lock);
+      cache[i].in_use = false;
+      cache[i].writing_back = false;
+    }
+  clock_hand = 0;
+  evict_waiters = 0;
+  cond_init (&entry_unlocked);
+
+  lock_init (&read_ahead_lock);
+  cond_init (&read_ahead_ready);
+  read_ahead_head = read_ahead_cnt = 0;
+
+  if (thread_create ("cache-flush", PRI_DEFAULT, flush_daemon, NULL)
+      == TID_ERROR)
+    PANIC ("can't start buffer cache flush daemon");
+  if (thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL)
+      == TID_ERROR)
+    PANIC ("can't start buffer cache read-ahead daemon");
+}
+
+/* Stops the daemons and writes every dirty sector back to disk,
+   in preparation for shutdown. */
+void
+cache_done (void)
+{
+  lock_acquire (&read_ahead_lock);
+  stopping = true;
+  read_ahead_cnt = 0;
+  cond_signal (&read_ahead_ready, &read_ahead_lock);
+  lock_release (&read_ahead_lock);
+
+  cache_flush ();
+}
+
+/* Completion function for the writes started by cache_flush(). */
+static void
+flush_done (void *sema)
+{
+  sema_up (sema);
+}
+
+/* Writes every dirty sector in the cache back to disk.  All of
+   the writes are queued before waiting for any of them, so that
+   the disk driver can sort and merge them. */
+void
+cache_flush (void)
+{
+  struct cache_entry *flushing[CACHE_SIZE];
+  struct semaphore done;
+  size_t flush_cnt = 0;
+  size_t i;
+
+  sema_init (&done, 0);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      /* E stays locked until its write completes. */
+      lock_acquire (&e->lock);
+      if (e->in_use && e->dirty)
+        {
+          block_write_async (fs_device, e->sector, 1, e->data,
+                             flush_done, &done);
+          e->dirty = false;
+          flushing[flush_cnt++] = e;
+        }
+      else
+        unlock_entry (e);
+    }
+
+  for (i = 0; i < flush_cnt; i++)
+    sema_down (&done);
+  for (i = 0; i < flush_cnt; i++)
+    unlock_entry (flushing[i]);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Writes SECTOR from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Reads SIZE bytes starting at SECTOR_OFS within SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer,
+               int size, int sector_ofs)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector_ofs >= 0 && size >= 0);
+  ASSERT (sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + sector_ofs, size);
+  unlock_entry (e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at
+   SECTOR_OFS.  The data reaches the disk when the sector is
+   evicted or flushed. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                int size, int sector_ofs)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector_ofs >= 0 && size >= 0);
+  ASSERT (sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* A write of the whole sector need not read it first. */
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + sector_ofs, buffer, size);
+  e->dirty = true;
+  unlock_entry (e);
+}
+
+/* Asks the read-ahead daemon to bring SECTOR into the cache in
+   the background.  Returns without waiting for the read. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&read_ahead_lock);
+  if (!stopping && read_ahead_cnt < READ_AHEAD_CNT)
+    {
+      size_t tail = (read_ahead_head + read_ahead_cnt) % READ_AHEAD_CNT;
+      read_ahead_queue[tail] = sector;
+      read_ahead_cnt++;
+      cond_signal (&read_ahead_ready, &read_ahead_lock);
+    }
+  lock_release (&read_ahead_lock);
+}
+
+/* Returns the entry holding SECTOR, with its lock held, loading
+   the sector into the cache if it is not already present.  If
+   NEED_READ is false then the caller is about to overwrite the
+   entire sector, so a miss does not read it from disk. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool need_read)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+
+      lock_acquire (&cache_lock);
+      e = lookup (sector);
+      if (e != NULL)
+        {
+          /* Hit.  Don't hold cache_lock while we wait, because
+             the holder of E may be doing disk I/O. */
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          if (e->in_use && e->sector == sector)
+            {
+              e->accessed = true;
+              return e;
+            }
+
+          /* E was evicted while we waited.  Start over. */
+          unlock_entry (e);
+          continue;
+        }
+
+      /* Miss.  Claim a victim for SECTOR before releasing
+         cache_lock, so that concurrent lookups find it and wait
+         on its lock until the data has been read in.  If we had
+         to wait for a victim, SECTOR may have been cached in the
+         meantime, so start over. */
+      e = evict (sector);
+      lock_release (&cache_lock);
+      if (e == NULL)
+        continue;
+
+      write_back (e);
+      if (need_read)
+        block_read (fs_device, sector, e->data);
+      return e;
+    }
+}
+
+/* Returns the entry that holds SECTOR, or a null pointer if
+   SECTOR is not cached.  An entry still writing SECTOR back
+   after evicting it counts as holding it, so that the caller
+   waits on its lock instead of reading a stale copy from disk.
+   cache_lock must be held. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (e->in_use
+          && (e->sector == sector
+              || (e->writing_back && e->old_sector == sector)))
+        return e;
+    }
+  return NULL;
+}
+
+/* Claims an entry for SECTOR, which must not be cached, using
+   the clock algorithm to choose a victim, and returns it with
+   its lock held.  Locked entries are skipped.  If the victim is
+   dirty, it keeps answering lookups of its old sector until the
+   caller passes it to write_back().  If every entry is locked,
+   waits for one to be unlocked and returns a null pointer, in
+   which case the caller must look up SECTOR again, because
+   cache_lock was released while waiting.  cache_lock must be
+   held. */
+static struct cache_entry *
+evict (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  /* Count ourselves first, so that an entry unlocked after the
+     scan below passes it still wakes us. */
+  evict_waiters++;
+
+  /* Two trips around clear every accessed bit, so only locked
+     entries can keep us from finding a victim. */
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (lock_held_by_current_thread (&e->lock)
+          || !lock_try_acquire (&e->lock))
+        continue;
+      if (e->in_use && e->accessed)
+        {
+          /* Second chance. */
+          e->accessed = false;
+          lock_release (&e->lock);
+          continue;
+        }
+
+      evict_waiters--;
+      e->writing_back = e->in_use && e->dirty;
+      e->old_sector = e->sector;
+      e->sector = sector;
+      e->in_use = true;
+      e->dirty = false;
+      e->accessed = true;
+      return e;
+    }
+
+  /* Every entry is busy.  Sleep until a holder finishes, instead
+     of spinning with cache_lock held. */
+  cond_wait (&entry_unlocked, &cache_lock);
+  evict_waiters--;
+  return NULL;
+}
+
+/* Writes back the dirty sector that evict() took E away from, if
+   any.  E must be locked and cache_lock must not be held, so that
+   other lookups proceed during the write.  Lookups of the old
+   sector wait on E's lock until the write is done, then find it
+   no longer cached and read it back from disk. */
+static void
+write_back (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (e->writing_back)
+    {
+      block_write (fs_device, e->old_sector, e->data);
+      e->writing_back = false;
+    }
+}
+
+/* Releases E's lock and wakes any threads in evict() waiting for
+   an unlocked entry.  cache_lock must not be held. */
+static void
+unlock_entry (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+  if (evict_waiters > 0)
+    {
+      lock_acquire (&cache_lock);
+      cond_broadcast (&entry_unlocked, &cache_lock);
+      lock_release (&cache_lock);
+    }
+}
+
+/* Write-behind daemon.  Bounds the amount of data lost if the
+   machine stops without a clean shutdown.  Exits once
+   cache_done() has been called. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      if (stopping)
+        break;
+      cache_flush ();
+    }
+}
+
+/* Read-ahead daemon.  Fetches queued sectors into the cache so
+   that sequential readers find them there.  Runs of consecutive
+   sectors are read with a single disk request.  Exits once
+   cache_done() has been called. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      size_t cnt;
+
+      lock_acquire (&read_ahead_lock);
+      while (read_ahead_cnt == 0 && !stopping)
+        cond_wait (&read_ahead_ready, &read_ahead_lock);
+      if (stopping)
+        {
+          lock_release (&read_ahead_lock);
+          break;
+        }
+      sector = read_ahead_queue[read_ahead_head];
+      cnt = 0;
+      do
+        {
+          read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_CNT;
+          read_ahead_cnt--;
+          cnt++;
+        }
+      while (read_ahead_cnt > 0 && cnt < READ_AHEAD_RUN
+             && read_ahead_queue[read_ahead_head] == sector + cnt);
+      lock_release (&read_ahead_lock);
+
+      read_ahead_run (sector, cnt);
+    }
+}
+
+/* Brings the CNT sectors starting at SECTOR into the cache,
+   stopping at the first one that is already cached.  Entries
+   for all of them are claimed before the read, as in
+   cache_get(), so that no one can observe them half-filled. */
+static void
+read_ahead_run (block_sector_t sector, size_t cnt)
+{
+  static uint8_t buffer[READ_AHEAD_RUN * BLOCK_SECTOR_SIZE];
+  struct cache_entry *run[READ_AHEAD_RUN];
+  size_t i;
+
+  ASSERT (cnt <= READ_AHEAD_RUN);
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cnt && lookup (sector + i) == NULL; i++)
+    {
+      run[i] = evict (sector + i);
+      if (run[i] == NULL)
+        break;
+    }
+  lock_release (&cache_lock);
+  cnt = i;
+  if (cnt == 0)
+    return;
+
+  for (i = 0; i < cnt; i++)
+    write_back (run[i]);
+  block_read_multiple (fs_device, sector, cnt, buffer);
+  for (i = 0; i < cnt; i++)
+    {
+      memcpy (run[i]->data, buffer + i * BLOCK_SECTOR_SIZE,
+              BLOCK_SECTOR_SIZE);
+      unlock_entry (run[i]);
+    }
+}
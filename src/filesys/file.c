@@ -1,16 +1,25 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/block.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Number of sectors to read ahead of a sequential reader.
+   Controlled by kernel command-line option "-ra". */
+size_t file_read_ahead_sectors = 8;
+
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t next_pos;             /* Position where last file_read() ended. */
+    off_t read_ahead_end;       /* End of data already read ahead. */
   };
 
+static void read_ahead (struct file *);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +32,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->next_pos = 0;
+      file->read_ahead_end = 0;
       return file;
     }
   else
@@ -64,15 +75,39 @@ file_get_inode (struct file *file)
    starting at the file's current position.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   Advances FILE's position by the number of bytes read. */
+   Advances FILE's position by the number of bytes read.
+   If this read continues where the previous one left off, also
+   starts reading the following sectors in the background. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
+  bool sequential = file->pos == file->next_pos;
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->next_pos = file->pos;
+  if (sequential)
+    read_ahead (file);
   return bytes_read;
 }
 
+/* Asks for the file_read_ahead_sectors sectors following FILE's
+   position to be brought into the buffer cache, skipping those
+   already requested. */
+static void
+read_ahead (struct file *file)
+{
+  off_t start = file->pos;
+  off_t end = file->pos + (off_t) file_read_ahead_sectors * BLOCK_SECTOR_SIZE;
+
+  if (file->read_ahead_end > start)
+    start = file->read_ahead_end;
+  if (start < end)
+    {
+      inode_read_ahead (file->inode, start, end);
+      file->read_ahead_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -87,9 +122,8 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file extends the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +136,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file extends the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -156,6 +189,7 @@ file_seek (struct file *file, off_t new_pos)
   ASSERT (file != NULL);
   ASSERT (new_pos >= 0);
   file->pos = new_pos;
+  file->read_ahead_end = new_pos;
 }
 
 /* Returns the current position in FILE as a byte offset from the
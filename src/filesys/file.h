@@ -1,10 +1,15 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stddef.h>
 #include "filesys/off_t.h"
 
 struct inode;
 
+/* Number of sectors to read ahead of a sequential reader.
+   Controlled by kernel command-line option "-ra". */
+extern size_t file_read_ahead_sectors;
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
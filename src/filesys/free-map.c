@@ -1,52 +1,144 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <limits.h>
+#include <list.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* The bitmap is the authoritative record of which sectors are
+   free, and it is what is kept on disk.  To avoid scanning it on
+   every allocation, the free sectors are also indexed in memory
+   as maximal runs, called extents.  Each extent can be found by
+   its first sector and by the sector just past its end, so that
+   a released run is merged with its neighbors in constant time,
+   and each is on the list for its size class, so that a best fit
+   is found without looking at smaller extents. */
+struct extent
+  {
+    struct hash_elem start_elem;        /* Element in extents_by_start. */
+    struct hash_elem end_elem;          /* Element in extents_by_end. */
+    struct list_elem size_elem;         /* Element in size_classes[]. */
+    block_sector_t start;               /* First free sector. */
+    size_t cnt;                         /* Number of free sectors. */
+  };
+
+/* Size class I holds extents of 2**I to 2**(I+1) - 1 sectors. */
+#define SIZE_CLASS_CNT 32
+static struct list size_classes[SIZE_CLASS_CNT];
+
+static struct hash extents_by_start;    /* Extents by first sector. */
+static struct hash extents_by_end;      /* Extents by sector past end. */
+
+/* False if some free sectors are missing from the index because
+   memory for an extent could not be allocated.  The index is
+   rebuilt from the bitmap before giving up on an allocation. */
+static bool index_complete;
+
+/* Protects the free map and its index. */
+static struct lock free_map_lock;
+
+static hash_hash_func extent_start_hash, extent_end_hash;
+static hash_less_func extent_start_less, extent_end_less;
+static void build_index (void);
+static void insert_extent (struct extent *);
+static void remove_extent (struct extent *);
+static struct extent *best_fit (size_t cnt);
+static void add_free (block_sector_t, size_t cnt);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  size_t i;
+
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  lock_init (&free_map_lock);
+  for (i = 0; i < SIZE_CLASS_CNT; i++)
+    list_init (&size_classes[i]);
+  if (!hash_init (&extents_by_start, extent_start_hash, extent_start_less,
+                  NULL)
+      || !hash_init (&extents_by_end, extent_end_hash, extent_end_less,
+                     NULL))
+    PANIC ("free map index creation failed");
+  build_index ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  Uses the smallest run of free
+   sectors that is large enough.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available or if the free_map file could not be
+   written. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  struct extent *e;
+  block_sector_t sector;
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  e = best_fit (cnt);
+  if (e == NULL && !index_complete)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      build_index ();
+      e = best_fit (cnt);
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  if (e != NULL)
+    {
+      /* Take the sectors from the front of E. */
+      sector = e->start;
+      remove_extent (e);
+      if (e->cnt > cnt)
+        {
+          e->start += cnt;
+          e->cnt -= cnt;
+          insert_extent (e);
+        }
+      else
+        free (e);
+
+      /* Write just the part of the bitmap that changed. */
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      if (free_map_file != NULL
+          && !bitmap_write_range (free_map, free_map_file, sector, cnt))
+        {
+          bitmap_set_multiple (free_map, sector, cnt, false); 
+          add_free (sector, cnt);
+        }
+      else
+        {
+          *sectorp = sector;
+          success = true;
+        }
+    }
+  lock_release (&free_map_lock);
+  return success;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  add_free (sector, cnt);
+  if (free_map_file != NULL)
+    bitmap_write_range (free_map, free_map_file, sector, cnt);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +150,10 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+
+  lock_acquire (&free_map_lock);
+  build_index ();
+  lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -83,3 +179,183 @@ free_map_create (void)
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
+
+/* Returns the size class for an extent of CNT sectors. */
+static inline size_t
+size_class (size_t cnt)
+{
+  ASSERT (cnt > 0);
+  return (CHAR_BIT * sizeof (unsigned) - 1) - __builtin_clz (cnt);
+}
+
+/* Adds extent E to the index. */
+static void
+insert_extent (struct extent *e)
+{
+  hash_insert (&extents_by_start, &e->start_elem);
+  hash_insert (&extents_by_end, &e->end_elem);
+  list_push_front (&size_classes[size_class (e->cnt)], &e->size_elem);
+}
+
+/* Removes extent E from the index. */
+static void
+remove_extent (struct extent *e)
+{
+  hash_delete (&extents_by_start, &e->start_elem);
+  hash_delete (&extents_by_end, &e->end_elem);
+  list_remove (&e->size_elem);
+}
+
+/* Adds the CNT free sectors starting at SECTOR to the index,
+   merging them with the extents on either side, if any. */
+static void
+add_free (block_sector_t sector, size_t cnt)
+{
+  struct extent key, *e = NULL;
+  struct hash_elem *h;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  /* Merge with the extent that ends at SECTOR. */
+  key.start = sector;
+  key.cnt = 0;
+  h = hash_find (&extents_by_end, &key.end_elem);
+  if (h != NULL)
+    {
+      e = hash_entry (h, struct extent, end_elem);
+      remove_extent (e);
+      sector = e->start;
+      cnt += e->cnt;
+    }
+
+  /* Merge with the extent that starts just past the new run. */
+  key.start = sector + cnt;
+  h = hash_find (&extents_by_start, &key.start_elem);
+  if (h != NULL)
+    {
+      struct extent *next = hash_entry (h, struct extent, start_elem);
+      remove_extent (next);
+      cnt += next->cnt;
+      if (e == NULL)
+        e = next;
+      else
+        free (next);
+    }
+
+  if (e == NULL)
+    {
+      e = malloc (sizeof *e);
+      if (e == NULL)
+        {
+          /* The sectors are still free in the bitmap. */
+          index_complete = false;
+          return;
+        }
+    }
+  e->start = sector;
+  e->cnt = cnt;
+  insert_extent (e);
+}
+
+/* Returns the smallest extent with at least CNT sectors, or a
+   null pointer if there is none. */
+static struct extent *
+best_fit (size_t cnt)
+{
+  size_t class;
+
+  ASSERT (cnt > 0);
+
+  /* Extents in a larger class are all larger than any that fits
+     in CNT's class, so the first class with a fit has the best
+     one. */
+  for (class = size_class (cnt); class < SIZE_CLASS_CNT; class++)
+    {
+      struct extent *best = NULL;
+      struct list_elem *elem;
+
+      for (elem = list_begin (&size_classes[class]);
+           elem != list_end (&size_classes[class]); elem = list_next (elem))
+        {
+          struct extent *e = list_entry (elem, struct extent, size_elem);
+          if (e->cnt >= cnt && (best == NULL || e->cnt < best->cnt))
+            {
+              best = e;
+              if (e->cnt == cnt)
+                break;
+            }
+        }
+      if (best != NULL)
+        return best;
+    }
+  return NULL;
+}
+
+/* Frees extent E, given its element in extents_by_start. */
+static void
+free_extent (struct hash_elem *h, void *aux UNUSED)
+{
+  free (hash_entry (h, struct extent, start_elem));
+}
+
+/* Discards the extent index and rebuilds it from the bitmap. */
+static void
+build_index (void)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t i;
+
+  hash_clear (&extents_by_end, NULL);
+  hash_clear (&extents_by_start, free_extent);
+  for (i = 0; i < SIZE_CLASS_CNT; i++)
+    list_init (&size_classes[i]);
+  index_complete = true;
+
+  for (i = 0; i < sector_cnt; )
+    {
+      size_t start = bitmap_scan (free_map, i, 1, false);
+      size_t end;
+
+      if (start == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = sector_cnt;
+      add_free (start, end - start);
+      i = end;
+    }
+}
+
+/* Returns a hash of extent E's first sector. */
+static unsigned
+extent_start_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct extent, start_elem)->start);
+}
+
+/* Returns true if extent A starts before extent B. */
+static bool
+extent_start_less (const struct hash_elem *a, const struct hash_elem *b,
+                   void *aux UNUSED)
+{
+  return (hash_entry (a, struct extent, start_elem)->start
+          < hash_entry (b, struct extent, start_elem)->start);
+}
+
+/* Returns a hash of the sector just past extent E's end. */
+static unsigned
+extent_end_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+  const struct extent *e = hash_entry (e_, struct extent, end_elem);
+  return hash_int (e->start + e->cnt);
+}
+
+/* Returns true if extent A ends before extent B. */
+static bool
+extent_end_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                 void *aux UNUSED)
+{
+  const struct extent *a = hash_entry (a_, struct extent, end_elem);
+  const struct extent *b = hash_entry (b_, struct extent, end_elem);
+  return a->start + a->cnt < b->start + b->cnt;
+}
@@ -1,23 +1,47 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Data sectors are found through a multilevel index.  The first
+   DIRECT_CNT sectors of a file are listed in the inode itself.
+   The inode also points to an indirect block, which lists the
+   next PTRS_PER_SECTOR sectors, and to a doubly indirect block,
+   which lists PTRS_PER_SECTOR indirect blocks.
+
+   A sector number of 0 in an index means that no sector has been
+   allocated there yet.  (Sector 0 holds the free map inode, so
+   it is never a data or index sector.)  Such sectors read as
+   zeros. */
+#define DIRECT_CNT 123
+#define INDIRECT_IDX DIRECT_CNT
+#define DBL_INDIRECT_IDX (DIRECT_CNT + 1)
+#define SECTOR_CNT (DIRECT_CNT + 2)
+#define PTRS_PER_SECTOR ((size_t) (BLOCK_SECTOR_SIZE / sizeof (block_sector_t)))
+
+/* Largest file, in sectors and in bytes. */
+#define MAX_FILE_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                          + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+#define MAX_FILE_LENGTH ((off_t) (MAX_FILE_SECTORS * BLOCK_SECTOR_SIZE))
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t sectors[SECTOR_CNT]; /* Direct and indirect sectors. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t unused[1];                 /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,37 +55,170 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in inode table. */
+    struct list_elem closed_elem;       /* Element in closed_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /* Serializes growth of data. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Allocates a sector, zeros it, and stores it in *SECTORP.
+   Returns true if successful, false if the disk is full. */
+static bool
+allocate_zeroed (block_sector_t *sectorp)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  cache_write (*sectorp, zeros);
+  return true;
+}
+
+/* Returns entry IDX of DISK_INODE's index, which is stored in
+   sector INODE_SECTOR.  If the entry is unallocated and ALLOCATE
+   is true, allocates a zeroed sector for it and writes
+   DISK_INODE back.  Returns 0 if the entry is unallocated or
+   allocation fails. */
+static block_sector_t
+inode_entry (struct inode_disk *disk_inode, block_sector_t inode_sector,
+             size_t idx, bool allocate)
+{
+  block_sector_t *entry = &disk_inode->sectors[idx];
+
+  if (*entry == 0 && allocate && allocate_zeroed (entry))
+    cache_write (inode_sector, disk_inode);
+  return *entry;
+}
+
+/* Returns entry IDX of the indirect block in sector INDEX.  If
+   the entry is unallocated and ALLOCATE is true, allocates a
+   zeroed sector for it.  Returns 0 if the entry is unallocated
+   or allocation fails. */
+static block_sector_t
+index_entry (block_sector_t index, size_t idx, bool allocate)
+{
+  block_sector_t sector;
+  int ofs = idx * sizeof sector;
+
+  cache_read_at (index, &sector, sizeof sector, ofs);
+  if (sector == 0 && allocate && allocate_zeroed (&sector))
+    cache_write_at (index, &sector, sizeof sector, ofs);
+  return sector;
+}
+
+/* Returns the sector that holds byte offset POS within the file
+   whose inode DISK_INODE is stored in INODE_SECTOR.  If ALLOCATE
+   is true, allocates the data sector and any index sectors
+   needed to reach it.  Returns 0 if no sector is allocated at
+   POS, or if allocation fails. */
+static block_sector_t
+lookup_sector (struct inode_disk *disk_inode, block_sector_t inode_sector,
+               off_t pos, bool allocate)
+{
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t index;
+
+  if (idx < DIRECT_CNT)
+    return inode_entry (disk_inode, inode_sector, idx, allocate);
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    {
+      index = inode_entry (disk_inode, inode_sector, INDIRECT_IDX, allocate);
+      return index != 0 ? index_entry (index, idx, allocate) : 0;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      index = inode_entry (disk_inode, inode_sector, DBL_INDIRECT_IDX,
+                           allocate);
+      if (index != 0)
+        index = index_entry (index, idx / PTRS_PER_SECTOR, allocate);
+      return index != 0 ? index_entry (index, idx % PTRS_PER_SECTOR,
+                                       allocate) : 0;
+    }
+  return 0;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   Returns 0 if INODE has no sector allocated for offset POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  return lookup_sector (&inode->data, inode->sector, pos, false);
+}
+
+/* Frees SECTOR, which is an index block with LEVEL levels of
+   index below it, or a data sector if LEVEL is 0, and every
+   sector it points to. */
+static void
+release_sector (block_sector_t sector, int level)
+{
+  if (level > 0)
+    {
+      size_t i;
+
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        {
+          block_sector_t entry = index_entry (sector, i, false);
+          if (entry != 0)
+            release_sector (entry, level - 1);
+        }
+    }
+  free_map_release (sector, 1);
+}
+
+/* Frees every data and index sector of DISK_INODE. */
+static void
+release_data (struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  for (i = 0; i < SECTOR_CNT; i++)
+    if (disk_inode->sectors[i] != 0)
+      release_sector (disk_inode->sectors[i],
+                      (i < DIRECT_CNT ? 0 : i == INDIRECT_IDX ? 1 : 2));
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of in-memory inodes, indexed by sector, so that opening
+   a single inode twice returns the same `struct inode'.  Holds
+   every open inode plus a few recently closed ones. */
+static struct hash inodes;
+
+/* Inodes in the table that are not open (open_cnt is 0), most
+   recently closed first.  Reopening one of them does not have to
+   read it from disk.  At most CLOSED_INODE_CNT are kept. */
+#define CLOSED_INODE_CNT 32
+static struct list closed_inodes;
+static size_t closed_inode_cnt;
+
+/* Protects inodes, closed_inodes, and every inode's open_cnt. */
+static struct lock inodes_lock;
+static struct lock_stats inodes_lock_stats;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+static struct inode *lookup_inode (block_sector_t);
+static void add_opener (struct inode *);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't create inode table");
+  list_init (&closed_inodes);
+  closed_inode_cnt = 0;
+  lock_init (&inodes_lock);
+  lock_stats_init (&inodes_lock_stats, "open inodes");
+  lock_set_stats (&inodes_lock, &inodes_lock_stats);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -81,25 +238,30 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if (length > MAX_FILE_LENGTH)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+      size_t i;
+
+      /* Allocate the initial LENGTH bytes now, so that creation
+         fails if the disk is full.  Sectors written past the end
+         later are allocated as they are written. */
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      success = true;
+      for (i = 0; i < sectors && success; i++)
+        if (lookup_sector (disk_inode, sector, i * BLOCK_SECTOR_SIZE,
+                           true) == 0)
+          success = false;
+
+      if (success)
+        cache_write (sector, disk_inode);
+      else
+        release_data (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -111,33 +273,45 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *other;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already in memory. */
+  lock_acquire (&inodes_lock);
+  inode = lookup_inode (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      add_opener (inode);
+      lock_release (&inodes_lock);
+      return inode;
     }
+  lock_release (&inodes_lock);
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The disk inode is read without holding
+     inodes_lock, so another thread may have opened the same
+     inode in the meantime. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->lock);
+  cache_read (inode->sector, &inode->data);
+
+  lock_acquire (&inodes_lock);
+  other = lookup_inode (sector);
+  if (other != NULL)
+    {
+      add_opener (other);
+      lock_release (&inodes_lock);
+      free (inode);
+      return other;
+    }
+  hash_insert (&inodes, &inode->elem);
+  lock_release (&inodes_lock);
   return inode;
 }
 
@@ -146,7 +320,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inodes_lock);
+      add_opener (inode);
+      lock_release (&inodes_lock);
+    }
   return inode;
 }
 
@@ -168,21 +346,36 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          /* Remove from inode table and release lock. */
+          hash_delete (&inodes, &inode->elem);
+          lock_release (&inodes_lock);
+
+          /* Deallocate blocks. */
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          release_data (&inode->data);
+          free (inode); 
+          return;
         }
 
-      free (inode); 
+      /* Keep INODE in memory in case it is reopened soon, and
+         discard the least recently closed inode if there are
+         too many. */
+      list_push_front (&closed_inodes, &inode->closed_elem);
+      if (++closed_inode_cnt > CLOSED_INODE_CNT)
+        {
+          struct inode *oldest = list_entry (list_pop_back (&closed_inodes),
+                                             struct inode, closed_elem);
+          hash_delete (&inodes, &oldest->elem);
+          closed_inode_cnt--;
+          free (oldest);
+        }
     }
+  lock_release (&inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -202,7 +395,6 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
@@ -220,47 +412,34 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy the chunk out of the buffer cache.  Unallocated
+         sectors read as zeros. */
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, chunk_size,
+                       sector_ofs);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the maximum file size
+   is reached.  Writing past end of file extends the inode;
+   sectors are allocated as they are first written. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
@@ -268,11 +447,12 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left before the maximum file size, bytes left in
+         sector, lesser of the two. */
+      off_t inode_left = MAX_FILE_LENGTH - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -281,42 +461,62 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* Find the sector, allocating it if this is the first
+         write to it. */
+      lock_acquire (&inode->lock);
+      sector_idx = lookup_sector (&inode->data, inode->sector, offset, true);
+      lock_release (&inode->lock);
+      if (sector_idx == 0)
+        break;
+
+      /* Copy the chunk into the buffer cache, which writes it
+         back to disk later. */
+      cache_write_at (sector_idx, buffer + bytes_written,
+                      chunk_size, sector_ofs);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file only after its new data is in place, so that
+     readers never see the new length before the data.  OFFSET
+     has advanced past the last byte written, if any.  A write
+     that wrote nothing does not extend the file. */
+  if (bytes_written > 0)
+    {
+      lock_acquire (&inode->lock);
+      if (offset > inode->data.length)
+        {
+          inode->data.length = offset;
+          cache_write (inode->sector, &inode->data);
+        }
+      lock_release (&inode->lock);
+    }
 
   return bytes_written;
 }
 
+/* Asks the buffer cache to fetch the sectors that hold bytes
+   START through END (exclusive) of INODE in the background.
+   Bytes beyond the end of INODE are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t start, off_t end)
+{
+  off_t pos;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (pos = ROUND_DOWN (start, BLOCK_SECTOR_SIZE); pos < end;
+       pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -343,3 +543,48 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Returns the inode in the inode table for SECTOR, or a null
+   pointer if there is none.  inodes_lock must be held. */
+static struct inode *
+lookup_inode (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&inodes_lock));
+
+  key.sector = sector;
+  e = hash_find (&inodes, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
+}
+
+/* Increments INODE's open count, taking it off the list of
+   closed inodes if it was there.  inodes_lock must be held. */
+static void
+add_opener (struct inode *inode)
+{
+  ASSERT (lock_held_by_current_thread (&inodes_lock));
+
+  if (inode->open_cnt++ == 0)
+    {
+      list_remove (&inode->closed_elem);
+      closed_inode_cnt--;
+    }
+}
+
+/* Returns a hash of inode E's sector. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
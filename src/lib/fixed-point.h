@@ -0,0 +1,97 @@
+#ifndef __LIB_FIXED_POINT_H
+#define __LIB_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* Signed 17.14 fixed-point numbers: 1 sign bit, 17 integer
+   bits, and 14 fraction bits packed into an int.  Values range
+   from about -131072 to 131071.99994.
+
+   The functions below that take an `int' argument mix a
+   fixed-point value with an ordinary integer. */
+typedef int fixed_point;
+
+/* Number of fraction bits. */
+#define FP_SHIFT 14
+
+/* The fixed-point representation of 1. */
+#define FP_ONE (1 << FP_SHIFT)
+
+/* Converts integer N to fixed point. */
+static inline fixed_point
+fp_from_int (int n)
+{
+  return n * FP_ONE;
+}
+
+/* Converts X to an integer, rounding toward zero. */
+static inline int
+fp_trunc (fixed_point x)
+{
+  return x / FP_ONE;
+}
+
+/* Converts X to an integer, rounding to nearest. */
+static inline int
+fp_round (fixed_point x)
+{
+  return x >= 0 ? (x + FP_ONE / 2) / FP_ONE : (x - FP_ONE / 2) / FP_ONE;
+}
+
+/* Returns X + Y. */
+static inline fixed_point
+fp_add (fixed_point x, fixed_point y)
+{
+  return x + y;
+}
+
+/* Returns X - Y. */
+static inline fixed_point
+fp_sub (fixed_point x, fixed_point y)
+{
+  return x - y;
+}
+
+/* Returns X + N. */
+static inline fixed_point
+fp_add_int (fixed_point x, int n)
+{
+  return x + n * FP_ONE;
+}
+
+/* Returns X - N. */
+static inline fixed_point
+fp_sub_int (fixed_point x, int n)
+{
+  return x - n * FP_ONE;
+}
+
+/* Returns X * Y. */
+static inline fixed_point
+fp_mul (fixed_point x, fixed_point y)
+{
+  return (int64_t) x * y / FP_ONE;
+}
+
+/* Returns X * N. */
+static inline fixed_point
+fp_mul_int (fixed_point x, int n)
+{
+  return x * n;
+}
+
+/* Returns X / Y. */
+static inline fixed_point
+fp_div (fixed_point x, fixed_point y)
+{
+  return (int64_t) x * FP_ONE / y;
+}
+
+/* Returns X / N. */
+static inline fixed_point
+fp_div_int (fixed_point x, int n)
+{
+  return x / n;
+}
+
+#endif /* lib/fixed-point.h */
@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -27,6 +28,8 @@ typedef unsigned long elem_type;
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
+    size_t first_free;  /* Every bit before this one is true. */
+    unsigned free_seq;  /* Incremented when bits may become false. */
     elem_type *bits;    /* Elements that represent bits. */
   };
 
@@ -68,7 +71,73 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns an elem_type with the bits corresponding to bits START
+   through END - 1 of the element that contains bit START turned
+   on.  END must not be past the end of that element. */
+static inline elem_type
+range_mask (size_t start, size_t end)
+{
+  size_t ofs = start % ELEM_BITS;
+  size_t cnt = end - start;
+
+  ASSERT (cnt > 0 && ofs + cnt <= ELEM_BITS);
+  return (cnt == ELEM_BITS ? (elem_type) -1
+          : (((elem_type) 1 << cnt) - 1) << ofs);
+}
+
+/* Returns the element of B numbered IDX, inverted if VALUE is
+   false, so that the bits set to VALUE are turned on. */
+static inline elem_type
+match_elem (const struct bitmap *b, size_t idx, bool value)
+{
+  return value ? b->bits[idx] : ~b->bits[idx];
+}
+
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or B's bit count if there is none.  Skips
+   whole elements that contain no such bit. */
+static size_t
+next_match (const struct bitmap *b, size_t start, bool value)
+{
+  size_t idx = elem_idx (start);
+  size_t last_idx = elem_cnt (b->bit_cnt);
+  elem_type bits;
+  size_t bit;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+
+  bits = match_elem (b, idx, value) & ((elem_type) -1 << (start % ELEM_BITS));
+  while (bits == 0)
+    {
+      if (++idx >= last_idx)
+        return b->bit_cnt;
+      bits = match_elem (b, idx, value);
+    }
+
+  /* Unused bits in the last element may appear to match. */
+  bit = idx * ELEM_BITS + __builtin_ctzl (bits);
+  return bit < b->bit_cnt ? bit : b->bit_cnt;
+}
 
+/* Records that bit BIT_IDX in B may just have become false,
+   lowering B's first_free hint below it if necessary.  Bits may
+   be freed by callers that cannot take the lock that serializes
+   allocation, such as palloc freeing a dying thread's page in
+   the middle of a context switch, so the update is made with
+   interrupts off to keep it atomic with the one in
+   bitmap_scan_and_flip(). */
+static void
+lower_hint (struct bitmap *b, size_t bit_idx)
+{
+  enum intr_level old_level = intr_disable ();
+  b->free_seq++;
+  if (bit_idx < b->first_free)
+    b->first_free = bit_idx;
+  intr_set_level (old_level);
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -82,6 +151,8 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
+      b->first_free = 0;
+      b->free_seq = 0;
       b->bits = malloc (byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
@@ -104,6 +175,8 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
   ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
   b->bit_cnt = bit_cnt;
+  b->first_free = 0;
+  b->free_seq = 0;
   b->bits = (elem_type *) (b + 1);
   bitmap_set_all (b, false);
   return b;
@@ -177,6 +250,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  lower_hint (b, bit_idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -192,6 +266,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  lower_hint (b, bit_idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -214,18 +289,36 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, a whole element at a
+   time. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t end = start + cnt;
   size_t i;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  for (i = start; i < end; )
+    {
+      size_t elem_end = (elem_idx (i) + 1) * ELEM_BITS;
+      size_t next = end < elem_end ? end : elem_end;
+      elem_type *elem = &b->bits[elem_idx (i)];
+      elem_type mask = range_mask (i, next);
+
+      /* See bitmap_mark() and bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "=m" (*elem) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (*elem) : "r" (~mask) : "cc");
+      i = next;
+    }
+
+  if (!value && cnt > 0)
+    lower_hint (b, start);
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -240,9 +333,16 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  for (i = start; i < start + cnt; )
+    {
+      size_t elem_end = (elem_idx (i) + 1) * ELEM_BITS;
+      size_t next = start + cnt < elem_end ? start + cnt : elem_end;
+      elem_type bits = match_elem (b, elem_idx (i), value);
+
+      for (bits &= range_mask (i, next); bits != 0; bits &= bits - 1)
+        value_cnt++;
+      i = next;
+    }
   return value_cnt;
 }
 
@@ -251,16 +351,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return next_match (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -289,6 +384,33 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /* Finding set or unset bits. */
 
+/* Finds the first run of CNT consecutive bits in B at or after
+   START that are all set to VALUE, as for bitmap_scan().  Also
+   stores into *FIRST the index of the first bit at or after START
+   that is set to VALUE, or B's bit count if there is none. */
+static size_t
+scan (const struct bitmap *b, size_t start, size_t cnt, bool value,
+      size_t *first) 
+{
+  size_t i;
+
+  /* Every bit before first_free is true. */
+  i = (!value && start < b->first_free) ? b->first_free : start;
+
+  *first = i = next_match (b, i, value);
+  if (cnt == 0)
+    return start;
+  while (i < b->bit_cnt && b->bit_cnt - i >= cnt)
+    {
+      /* Bits I through END - 1 are all VALUE. */
+      size_t end = next_match (b, i, !value);
+      if (end - i >= cnt)
+        return i;
+      i = next_match (b, end, value);
+    }
+  return BITMAP_ERROR;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -296,18 +418,12 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t first;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
-    {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
-    }
-  return BITMAP_ERROR;
+  return scan (b, start, cnt, value, &first);
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -320,9 +436,27 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t idx = bitmap_scan (b, start, cnt, value);
+  unsigned free_seq = b->free_seq;
+  enum intr_level old_level;
+  size_t first;
+  size_t idx;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+
+  idx = scan (b, start, cnt, value, &first);
   if (idx != BITMAP_ERROR) 
     bitmap_set_multiple (b, idx, cnt, !value);
+
+  /* A scan for false bits that began at or before first_free has
+     found the true first free bit, which may just have been
+     taken.  That no longer holds if a bit became false during the
+     scan, so leave the hint alone then: it is still correct,
+     because it was lowered as needed. */
+  old_level = intr_disable ();
+  if (!value && start <= b->first_free && free_seq == b->free_seq)
+    b->first_free = (idx == first ? first + cnt : first);
+  intr_set_level (old_level);
   return idx;
 }
 
@@ -347,6 +481,7 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      b->first_free = 0;
     }
   return success;
 }
@@ -359,6 +494,30 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the bits of B numbered START through START + CNT - 1,
+   rounded out to whole elements, to the same place in FILE that
+   bitmap_write() would put them.  Return true if successful,
+   false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  size_t first, last;
+  off_t size;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  if (cnt == 0)
+    return true;
+  first = elem_idx (start);
+  last = elem_idx (start + cnt - 1);
+  size = (last - first + 1) * sizeof (elem_type);
+  return file_write_at (file, b->bits + first, size,
+                        first * sizeof (elem_type)) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -28,7 +28,12 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_CLOCK,                  /* Nanoseconds since boot. */
+    SYS_FUTEX_WAIT,             /* Sleep until a futex changes. */
+    SYS_FUTEX_WAKE              /* Wake threads sleeping on a futex. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,133 @@
+#include <synch.h>
+#include <limits.h>
+#include <syscall.h>
+
+/* The mutex follows "Futexes Are Tricky" by Ulrich Drepper: the
+   state is 0 when the mutex is unlocked, 1 when it is locked
+   with no waiters, and 2 when it is locked and threads may be
+   waiting for it.  Only the transitions into and out of state 2
+   involve the kernel. */
+
+/* Atomically stores NEW into *P and returns the old value. */
+static inline int
+atomic_xchg (int *p, int new)
+{
+  /* See [IA32-v2b] "XCHG".  XCHG with a memory operand is always
+     locked. */
+  asm volatile ("xchgl %0, %1" : "+r" (new), "+m" (*p) : : "memory");
+  return new;
+}
+
+/* Atomically stores NEW into *P if *P equals OLD.  Returns the
+   previous value of *P. */
+static inline int
+atomic_cmpxchg (int *p, int old, int new)
+{
+  /* See [IA32-v2a] "CMPXCHG". */
+  int prev;
+  asm volatile ("lock cmpxchgl %2, %1"
+                : "=a" (prev), "+m" (*p)
+                : "r" (new), "0" (old)
+                : "memory");
+  return prev;
+}
+
+/* Initializes M as unlocked. */
+void
+mutex_init (struct mutex *m)
+{
+  m->state = 0;
+}
+
+/* Acquires M, sleeping until it becomes available if
+   necessary. */
+void
+mutex_lock (struct mutex *m)
+{
+  int c = atomic_cmpxchg (&m->state, 0, 1);
+
+  if (c == 0)
+    return;
+
+  /* Contended.  Mark the mutex as having waiters and sleep until
+     we are the one that finds it unlocked. */
+  if (c != 2)
+    c = atomic_xchg (&m->state, 2);
+  while (c != 0)
+    {
+      futex_wait (&m->state, 2);
+      c = atomic_xchg (&m->state, 2);
+    }
+}
+
+/* Acquires M if it is unlocked and returns true, or returns
+   false without sleeping if it is locked. */
+bool
+mutex_trylock (struct mutex *m)
+{
+  return atomic_cmpxchg (&m->state, 0, 1) == 0;
+}
+
+/* Releases M, which the calling thread must hold, waking a
+   waiter if there may be one. */
+void
+mutex_unlock (struct mutex *m)
+{
+  if (atomic_xchg (&m->state, 0) == 2)
+    futex_wake (&m->state, 1);
+}
+
+/* Initializes CV. */
+void
+condvar_init (struct condvar *cv)
+{
+  cv->seq = 0;
+  cv->waiter_cnt = 0;
+}
+
+/* Atomically releases M and waits for CV to be signaled, then
+   reacquires M.  M must be held.  As with the kernel's condition
+   variables, the caller must recheck its condition after
+   waking. */
+void
+condvar_wait (struct condvar *cv, struct mutex *m)
+{
+  unsigned seq;
+
+  cv->waiter_cnt++;
+  seq = cv->seq;
+  mutex_unlock (m);
+
+  /* Returns at once if CV was signaled since we read SEQ.  SEQ
+     is unsigned so that it wraps around without overflow; the
+     futex compares only its bits. */
+  futex_wait ((int *) &cv->seq, (int) seq);
+
+  /* Other threads may be sleeping on M, so reacquire it in the
+     "maybe waiters" state to make sure they get woken. */
+  while (atomic_xchg (&m->state, 2) != 0)
+    futex_wait (&m->state, 2);
+  cv->waiter_cnt--;
+}
+
+/* Wakes one thread waiting on CV, if any.  M must be held. */
+void
+condvar_signal (struct condvar *cv, struct mutex *m UNUSED)
+{
+  if (cv->waiter_cnt > 0)
+    {
+      cv->seq++;
+      futex_wake ((int *) &cv->seq, 1);
+    }
+}
+
+/* Wakes every thread waiting on CV.  M must be held. */
+void
+condvar_broadcast (struct condvar *cv, struct mutex *m UNUSED)
+{
+  if (cv->waiter_cnt > 0)
+    {
+      cv->seq++;
+      futex_wake ((int *) &cv->seq, INT_MAX);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef __LIB_USER_SYNCH_H
+#define __LIB_USER_SYNCH_H
+
+#include <stdbool.h>
+
+/* A mutex built on futexes.  Locking and unlocking a mutex that
+   no other thread is contending for do not enter the kernel.
+   Processes that share a mutex must keep it in a file that all
+   of them map with mmap. */
+struct mutex
+  {
+    int state;                  /* 0 = unlocked, 1 = locked,
+                                   2 = locked, maybe with waiters. */
+  };
+
+#define MUTEX_INITIALIZER { 0 }
+
+void mutex_init (struct mutex *);
+void mutex_lock (struct mutex *);
+bool mutex_trylock (struct mutex *);
+void mutex_unlock (struct mutex *);
+
+/* A condition variable built on futexes.  Signaling a condition
+   variable that no thread is waiting on does not enter the
+   kernel. */
+struct condvar
+  {
+    unsigned seq;               /* Incremented by each signal. */
+    int waiter_cnt;             /* # of waiters, protected by the mutex. */
+  };
+
+#define CONDVAR_INITIALIZER { 0, 0 }
+
+void condvar_init (struct condvar *);
+void condvar_wait (struct condvar *, struct mutex *);
+void condvar_signal (struct condvar *, struct mutex *);
+void condvar_broadcast (struct condvar *, struct mutex *);
+
+#endif /* lib/user/synch.h */
@@ -182,3 +182,23 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int64_t
+clock_ns (void)
+{
+  int64_t ns;
+  syscall1 (SYS_CLOCK, &ns);
+  return ns;
+}
+
+int
+futex_wait (int *addr, int expected)
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, expected);
+}
+
+int
+futex_wake (int *addr, int cnt)
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, cnt);
+}
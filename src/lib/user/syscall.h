@@ -2,6 +2,7 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <debug.h>
 
 /* Process identifier. */
@@ -45,4 +46,9 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int64_t clock_ns (void);
+int futex_wait (int *addr, int expected);
+int futex_wake (int *addr, int cnt);
+
 #endif /* lib/user/syscall.h */
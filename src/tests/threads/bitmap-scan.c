@@ -0,0 +1,149 @@
+/* Checks bitmap_scan() against a simple bit-at-a-time scan, and
+   checks that bitmap_scan_and_flip() keeps finding the lowest
+   free bits as bits are freed with bitmap_reset() and
+   bitmap_set_multiple(), which exercises the first free bit hint.
+   Then times scans of a 1M-bit bitmap filled to various levels. */
+
+#include <bitmap.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "devices/timer.h"
+
+/* Number of bits in the bitmap under test. */
+#define BIT_CNT (1024 * 1024)
+
+/* Number of scans timed for each fill level and run length. */
+#define SCAN_CNT 100
+
+static void check_hint (void);
+static void fill (struct bitmap *, int percent);
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt,
+                         bool value);
+
+void
+test_bitmap_scan (void)
+{
+  static const int fill_levels[] = {0, 50, 90, 99, 100};
+  static const size_t run_lengths[] = {1, 8, 64};
+  struct bitmap *b;
+  size_t i, j;
+
+  check_hint ();
+
+  b = bitmap_create (BIT_CNT);
+  ASSERT (b != NULL);
+
+  msg ("%d-bit bitmap, ticks for %d scans:", BIT_CNT, SCAN_CNT);
+  for (i = 0; i < sizeof fill_levels / sizeof *fill_levels; i++)
+    {
+      fill (b, fill_levels[i]);
+      for (j = 0; j < sizeof run_lengths / sizeof *run_lengths; j++)
+        {
+          size_t cnt = run_lengths[j];
+          size_t start = random_ulong () % BIT_CNT;
+          int64_t ticks;
+          int k;
+
+          /* Check against the simple implementation. */
+          ASSERT (bitmap_scan (b, 0, cnt, false)
+                  == slow_scan (b, 0, cnt, false));
+          ASSERT (bitmap_scan (b, start, cnt, false)
+                  == slow_scan (b, start, cnt, false));
+          ASSERT (bitmap_scan (b, start, cnt, true)
+                  == slow_scan (b, start, cnt, true));
+          ASSERT (bitmap_count (b, 0, BIT_CNT, true)
+                  + bitmap_count (b, 0, BIT_CNT, false) == BIT_CNT);
+
+          ticks = timer_ticks ();
+          for (k = 0; k < SCAN_CNT; k++)
+            bitmap_scan (b, 0, cnt, false);
+          msg ("%3d%% full, %zu-bit runs: %"PRId64" ticks",
+               fill_levels[i], cnt, timer_elapsed (ticks));
+        }
+    }
+
+  bitmap_destroy (b);
+  pass ();
+}
+
+/* Allocates bits with bitmap_scan_and_flip(), frees some below
+   the first free bit hint, and checks that they are found
+   again. */
+static void
+check_hint (void)
+{
+  struct bitmap *b = bitmap_create (256);
+  size_t i;
+
+  ASSERT (b != NULL);
+
+  /* Allocate bits 0 through 99 in order. */
+  for (i = 0; i < 100; i++)
+    ASSERT (bitmap_scan_and_flip (b, 0, 1, false) == i);
+
+  /* A single freed bit is found first. */
+  bitmap_reset (b, 3);
+  ASSERT (bitmap_scan_and_flip (b, 0, 1, false) == 3);
+  ASSERT (bitmap_scan_and_flip (b, 0, 1, false) == 100);
+
+  /* So is a freed run, including by a multi-bit scan. */
+  bitmap_set_multiple (b, 40, 8, false);
+  ASSERT (bitmap_scan_and_flip (b, 0, 4, false) == 40);
+  ASSERT (bitmap_scan_and_flip (b, 0, 1, false) == 44);
+  ASSERT (bitmap_scan_and_flip (b, 0, 4, false) == 101);
+  ASSERT (bitmap_scan_and_flip (b, 0, 3, false) == 45);
+
+  /* A scan that starts past the hint does not move it. */
+  bitmap_reset (b, 10);
+  ASSERT (bitmap_scan_and_flip (b, 200, 1, false) == 200);
+  ASSERT (bitmap_scan_and_flip (b, 0, 1, false) == 10);
+
+  /* Every result agrees with the simple implementation. */
+  for (i = 0; i < 256; i++)
+    if (random_ulong () % 3 == 0)
+      bitmap_reset (b, i);
+  while (slow_scan (b, 0, 2, false) != BITMAP_ERROR)
+    {
+      size_t expected = slow_scan (b, 0, 2, false);
+      ASSERT (bitmap_scan_and_flip (b, 0, 2, false) == expected);
+    }
+  ASSERT (bitmap_scan_and_flip (b, 0, 2, false) == BITMAP_ERROR);
+
+  bitmap_destroy (b);
+  msg ("first free bit hint ok");
+}
+
+/* Sets each bit in B to true with probability PERCENT/100. */
+static void
+fill (struct bitmap *b, int percent)
+{
+  size_t i;
+
+  bitmap_set_all (b, false);
+  for (i = 0; i < bitmap_size (b); i++)
+    if ((int) (random_ulong () % 100) < percent)
+      bitmap_mark (b, i);
+}
+
+/* Returns the first run of CNT bits in B at or after START that
+   are all VALUE, testing one bit at a time, or BITMAP_ERROR if
+   there is none. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t run = 0;
+  size_t i;
+
+  if (cnt == 0)
+    return start;
+  for (i = start; i < bitmap_size (b); i++)
+    {
+      run = bitmap_test (b, i) == value ? run + 1 : 0;
+      if (run == cnt)
+        return i + 1 - cnt;
+    }
+  return BITMAP_ERROR;
+}
@@ -0,0 +1,48 @@
+/* Locks and unlocks a mutex, and signals a condition variable,
+   that no other thread contends for.  None of these may enter
+   the kernel.
+
+   The mutex and condition variable are placed at odd addresses.
+   The futex system calls kill a process that passes a misaligned
+   futex, so any system call on them would end the test with
+   exit(-1). */
+
+#include <synch.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char mutex_buf[sizeof (struct mutex) + 1];
+static char condvar_buf[sizeof (struct condvar) + 1];
+
+void
+test_main (void) 
+{
+  struct mutex *m = (struct mutex *) (mutex_buf + 1);
+  struct condvar *cv = (struct condvar *) (condvar_buf + 1);
+  int i;
+
+  mutex_init (m);
+  condvar_init (cv);
+
+  msg ("lock and unlock mutex");
+  for (i = 0; i < 100; i++)
+    {
+      mutex_lock (m);
+      if (m->state != 1)
+        fail ("locked mutex has state %d, not 1", m->state);
+      mutex_unlock (m);
+      if (m->state != 0)
+        fail ("unlocked mutex has state %d, not 0", m->state);
+    }
+
+  CHECK (mutex_trylock (m), "trylock unlocked mutex");
+  CHECK (!mutex_trylock (m), "trylock locked mutex");
+  CHECK (m->state == 1, "failed trylock leaves mutex uncontended");
+
+  msg ("signal and broadcast condition variable");
+  condvar_signal (cv, m);
+  condvar_broadcast (cv, m);
+  mutex_unlock (m);
+  CHECK (m->state == 0, "unlock mutex");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-mutex) begin
+(futex-mutex) lock and unlock mutex
+(futex-mutex) trylock unlocked mutex
+(futex-mutex) trylock locked mutex
+(futex-mutex) failed trylock leaves mutex uncontended
+(futex-mutex) signal and broadcast condition variable
+(futex-mutex) unlock mutex
+(futex-mutex) end
+futex-mutex: exit(0)
+EOF
+pass;
@@ -0,0 +1,17 @@
+/* Calls futex_wait() on futexes that do not hold the expected
+   value, which must return -1 at once instead of sleeping. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int futex = 1;
+
+  CHECK (futex_wait (&futex, 0) == -1, "futex_wait with mismatched value");
+  futex = -1;
+  CHECK (futex_wait (&futex, 1) == -1, "futex_wait after futex changes");
+  CHECK (futex == -1, "futex_wait leaves futex unchanged");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-wait) begin
+(futex-wait) futex_wait with mismatched value
+(futex-wait) futex_wait after futex changes
+(futex-wait) futex_wait leaves futex unchanged
+(futex-wait) end
+futex-wait: exit(0)
+EOF
+pass;
@@ -0,0 +1,22 @@
+/* Calls futex_wake() on futexes with no waiters, which must
+   report that it woke no threads for any count.  A futex_wait()
+   that fails on a mismatched value must not leave a waiter
+   behind. */
+
+#include <limits.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int futex = 0;
+
+  CHECK (futex_wake (&futex, 0) == 0, "futex_wake 0 wakes none");
+  CHECK (futex_wake (&futex, 1) == 0, "futex_wake 1 wakes none");
+  CHECK (futex_wake (&futex, INT_MAX) == 0, "futex_wake INT_MAX wakes none");
+  CHECK (futex_wait (&futex, 1) == -1, "futex_wait with mismatched value");
+  CHECK (futex_wake (&futex, INT_MAX) == 0,
+         "futex_wake after failed wait wakes none");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-wake) begin
+(futex-wake) futex_wake 0 wakes none
+(futex-wake) futex_wake 1 wakes none
+(futex-wake) futex_wake INT_MAX wakes none
+(futex-wake) futex_wait with mismatched value
+(futex-wake) futex_wake after failed wait wakes none
+(futex-wake) end
+futex-wake: exit(0)
+EOF
+pass;
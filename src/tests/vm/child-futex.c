@@ -0,0 +1,34 @@
+/* Child process of futex-shared.
+   Maps the file that futex-shared created, tells it so, and
+   sleeps on a futex in the mapping until futex-shared wakes
+   it. */
+
+#include <debug.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/futex-shared.h"
+
+const char *test_name = "child-futex";
+
+int
+main (int argc UNUSED, char *argv[] UNUSED)
+{
+  struct futex_shared *s = (struct futex_shared *) 0x10000000;
+  int handle;
+
+  quiet = true;
+
+  CHECK ((handle = open (FUTEX_FILE)) > 1, "open \"%s\"", FUTEX_FILE);
+  CHECK (mmap (handle, s) != MAP_FAILED, "mmap \"%s\"", FUTEX_FILE);
+
+  s->ready = 1;
+  futex_wake (&s->ready, 1);
+
+  s->wait_result = futex_wait (&s->gate, 0);
+  s->value = 0x1234;
+
+  s->done = 1;
+  futex_wake (&s->done, 1);
+  return 0;
+}
@@ -0,0 +1,44 @@
+/* Maps a file and runs child-futex, which maps the same file,
+   then synchronizes with the child through futexes in the
+   mapping.  The child sleeps in futex_wait() until we wake it
+   with futex_wake(), which must report waking exactly one
+   thread, and then wakes us in turn.  Checks that each process
+   sees the other's stores to the mapping. */
+
+#include <limits.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/futex-shared.h"
+
+void
+test_main (void)
+{
+  struct futex_shared *s = (struct futex_shared *) 0x10000000;
+  int handle;
+  int woken;
+
+  CHECK (create (FUTEX_FILE, sizeof *s), "create \"%s\"", FUTEX_FILE);
+  CHECK ((handle = open (FUTEX_FILE)) > 1, "open \"%s\"", FUTEX_FILE);
+  CHECK (mmap (handle, s) != MAP_FAILED, "mmap \"%s\"", FUTEX_FILE);
+  CHECK (exec ("child-futex") != -1, "exec \"child-futex\"");
+
+  /* Sleep until the child has mapped the file.  futex_wait()
+     returns -1 at once if the child got there first. */
+  while (s->ready == 0)
+    futex_wait (&s->ready, 0);
+  msg ("child mapped \"%s\"", FUTEX_FILE);
+
+  /* The child is about to sleep on GATE, which stays 0.  Keep
+     trying to wake it until it does. */
+  while ((woken = futex_wake (&s->gate, INT_MAX)) == 0)
+    continue;
+  if (woken != 1)
+    fail ("futex_wake woke %d threads, not 1", woken);
+  msg ("futex_wake woke child");
+
+  while (s->done == 0)
+    futex_wait (&s->done, 0);
+  CHECK (s->wait_result == 0, "child's futex_wait returned 0");
+  CHECK (s->value == 0x1234, "child's store is visible");
+}
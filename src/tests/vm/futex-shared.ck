@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(futex-shared) begin
+(futex-shared) create "futex-data"
+(futex-shared) open "futex-data"
+(futex-shared) mmap "futex-data"
+(futex-shared) exec "child-futex"
+(futex-shared) child mapped "futex-data"
+(futex-shared) futex_wake woke child
+(futex-shared) child's futex_wait returned 0
+(futex-shared) child's store is visible
+(futex-shared) end
+EOF
+pass;
@@ -0,0 +1,17 @@
+#ifndef TESTS_VM_FUTEX_SHARED_H
+#define TESTS_VM_FUTEX_SHARED_H
+
+/* File that futex-shared and child-futex both map. */
+#define FUTEX_FILE "futex-data"
+
+/* Layout of the shared file.  Each int is a futex. */
+struct futex_shared
+  {
+    int ready;                  /* Set by child once it has mapped. */
+    int gate;                   /* Child sleeps on this until woken. */
+    int done;                   /* Set by child when finished. */
+    int wait_result;            /* Child's futex_wait() return value. */
+    int value;                  /* Stored by child after waking. */
+  };
+
+#endif /* tests/vm/futex-shared.h */
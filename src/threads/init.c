@@ -34,9 +34,15 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -98,6 +104,9 @@ main (void)
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+#ifdef VM
+  frame_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -126,6 +135,9 @@ main (void)
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
+#ifdef VM
+  swap_init ();
+#endif
 
   printf ("Boot complete.\n");
   
@@ -247,15 +259,21 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ra"))
+        file_read_ahead_sectors = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-stack"))
+        stack_page_limit = atoi (value);
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -373,12 +391,15 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ra=SECTORS        Read ahead SECTORS on sequential reads.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -stack=COUNT       Limit user stacks to COUNT pages.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the timer tick while idle.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -258,6 +258,34 @@ pic_init (void)
   outb (PIC1_DATA, 0x00);
 }
 
+/* Returns true if external interrupt VEC_NO has been raised but
+   not yet delivered, e.g. because interrupts are turned off. */
+bool
+intr_is_pending (uint8_t vec_no)
+{
+  int irq = vec_no - 0x20;
+  enum intr_level old_level;
+  uint8_t irr;
+
+  ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+
+  /* OCW3: read the Interrupt Request Register. */
+  old_level = intr_disable ();
+  if (irq < 8)
+    {
+      outb (PIC0_CTRL, 0x0a);
+      irr = inb (PIC0_CTRL);
+    }
+  else
+    {
+      outb (PIC1_CTRL, 0x0a);
+      irr = inb (PIC1_CTRL);
+      irq -= 8;
+    }
+  intr_set_level (old_level);
+  return (irr & (1 << irq)) != 0;
+}
+
 /* Sends an end-of-interrupt signal to the PIC for the given IRQ.
    If we don't acknowledge the IRQ, it will never be delivered to
    us again, so this is important.  */
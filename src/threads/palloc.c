@@ -29,6 +29,7 @@
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
+    struct lock_stats lock_stats;       /* Contention on lock. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
   };
@@ -165,6 +166,8 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
+  lock_stats_init (&p->lock_stats, name);
+  lock_set_stats (&p->lock, &p->lock_stats);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
 }
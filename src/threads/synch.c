@@ -29,9 +29,26 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Longest chain of lock holders that a priority donation is
+   passed along, e.g. H waits for a lock held by M, which waits
+   for a lock held by L, and so on. */
+#define DONATION_DEPTH 8
+
+/* Every registered struct lock_stats. */
+static struct list all_lock_stats = LIST_INITIALIZER (all_lock_stats);
+
+static void lock_acquired (struct lock *);
+static void donate_priority (struct lock *);
+static int max_waiter_priority (struct semaphore *);
+static void rwlock_wake (struct rwlock *);
+static int64_t stats_acquired (struct lock_stats *, bool waited,
+                               int64_t wait_start);
+static void stats_released (struct lock_stats *, int64_t acquire_time);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -102,9 +119,12 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any, yielding to it if it outranks the running thread.
+   Waiters of equal priority are woken in FIFO order.
 
-   This function may be called from an interrupt handler. */
+   This function may be called from an interrupt handler.  If it
+   is called with interrupts disabled, it does not yield. */
 void
 sema_up (struct semaphore *sema) 
 {
@@ -114,10 +134,19 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      /* Choose the waiter when waking it, rather than keeping the
+         list sorted, because donation can change the priority of
+         a waiting thread. */
+      struct list_elem *e = list_max (&sema->waiters, thread_less, NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
+
+  if (old_level == INTR_ON || intr_context ())
+    thread_yield_to_higher ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -178,9 +207,22 @@ lock_init (struct lock *lock)
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
+  lock->max_priority = PRI_MIN;
+  lock->stats = NULL;
   sema_init (&lock->semaphore, 1);
 }
 
+/* Makes LOCK record its contention in STATS, which may be shared
+   with other locks.  STATS must have been initialized with
+   lock_stats_init(). */
+void
+lock_set_stats (struct lock *lock, struct lock_stats *stats)
+{
+  ASSERT (lock != NULL);
+
+  lock->stats = stats;
+}
+
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
@@ -192,12 +234,36 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool waited;
+  int64_t wait_start = 0;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  waited = lock->holder != NULL;
+  if (waited)
+    {
+      if (lock->stats != NULL)
+        wait_start = timer_now_ns ();
+      if (!thread_mlfqs)
+        {
+          /* Lend our priority to the holder, and to whatever it
+             is waiting for in turn, while we wait. */
+          cur->waiting_lock = lock;
+          donate_priority (lock);
+        }
+    }
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  cur->waiting_lock = NULL;
+  lock->holder = cur;
+  lock_acquired (lock);
+  if (lock->stats != NULL)
+    lock->acquire_time = stats_acquired (lock->stats, waited, wait_start);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -209,14 +275,22 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      lock_acquired (lock);
+      if (lock->stats != NULL)
+        lock->acquire_time = stats_acquired (lock->stats, false, 0);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -228,11 +302,26 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  /* Give back the priority donated through LOCK. */
+  old_level = intr_disable ();
+  if (lock->stats != NULL)
+    stats_released (lock->stats, lock->acquire_time);
+  list_remove (&lock->elem);
   lock->holder = NULL;
+  if (!thread_mlfqs)
+    thread_refresh_priority (cur);
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
+
+  /* A waiter may now outrank us. */
+  if (old_level == INTR_ON)
+    thread_yield_to_higher ();
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -245,14 +334,328 @@ lock_held_by_current_thread (const struct lock *lock)
 
   return lock->holder == thread_current ();
 }
+
+/* Records that the current thread now holds LOCK, and takes on
+   the priority of the threads still waiting for it.  Interrupts
+   must be off. */
+static void
+lock_acquired (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_back (&cur->locks, &lock->elem);
+  if (!thread_mlfqs)
+    {
+      lock->max_priority = max_waiter_priority (&lock->semaphore);
+      thread_donate_priority (cur, lock->max_priority);
+    }
+}
+
+/* Passes the current thread's priority to the holder of LOCK,
+   which the current thread is about to wait for, and on along
+   the chain of locks that holder is waiting for, up to
+   DONATION_DEPTH links.  Interrupts must be off. */
+static void
+donate_priority (struct lock *lock)
+{
+  int priority = thread_current ()->priority;
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; depth < DONATION_DEPTH; depth++)
+    {
+      if (lock == NULL || lock->holder == NULL
+          || lock->max_priority >= priority)
+        break;
+      lock->max_priority = priority;
+      thread_donate_priority (lock->holder, priority);
+      lock = lock->holder->waiting_lock;
+    }
+}
+
+/* Returns the highest priority among the threads waiting for
+   SEMA, or PRI_MIN if there are none.  Interrupts must be off. */
+static int
+max_waiter_priority (struct semaphore *sema)
+{
+  if (list_empty (&sema->waiters))
+    return PRI_MIN;
+  return list_entry (list_max (&sema->waiters, thread_less, NULL),
+                     struct thread, elem)->priority;
+}
 
+/* Initializes RW as an unheld reader-writer lock.  A reader-writer
+   lock may be held by any number of readers, or by a single
+   writer, at any given time.  Like locks, reader-writer locks
+   are not recursive.
+
+   When a writer releases the lock, or the last reader does, the
+   highest-priority waiting writer gets it next.  If no writer is
+   waiting, every waiting reader gets it.  New readers wait while
+   a writer is waiting, so that a steady stream of readers cannot
+   keep writers out.  Unlike locks, reader-writer locks do not
+   donate priority, because they may have many holders. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  rw->reader_cnt = 0;
+  rw->writer = NULL;
+  list_init (&rw->read_waiters);
+  list_init (&rw->write_waiters);
+  rw->stats = NULL;
+}
+
+/* Makes RW record its contention in STATS, as for
+   lock_set_stats().  Hold times are recorded only for writers. */
+void
+rwlock_set_stats (struct rwlock *rw, struct lock_stats *stats)
+{
+  ASSERT (rw != NULL);
+
+  rw->stats = stats;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it or
+   is waiting for it if necessary.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+  bool waited;
+  int64_t wait_start = 0;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != thread_current ());
+
+  old_level = intr_disable ();
+  waited = rw->writer != NULL || !list_empty (&rw->write_waiters);
+  if (!waited)
+    rw->reader_cnt++;
+  else
+    {
+      /* rwlock_wake() counts us as a reader when it wakes us. */
+      if (rw->stats != NULL)
+        wait_start = timer_now_ns ();
+      list_push_back (&rw->read_waiters, &thread_current ()->elem);
+      thread_block ();
+    }
+  if (rw->stats != NULL)
+    stats_acquired (rw->stats, waited, wait_start);
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for reading. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->reader_cnt > 0);
+
+  old_level = intr_disable ();
+  if (--rw->reader_cnt == 0)
+    rwlock_wake (rw);
+  intr_set_level (old_level);
+
+  if (old_level == INTR_ON)
+    thread_yield_to_higher ();
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it if necessary.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool waited;
+  int64_t wait_start = 0;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != cur);
+
+  old_level = intr_disable ();
+  waited = rw->writer != NULL || rw->reader_cnt > 0;
+  if (!waited)
+    rw->writer = cur;
+  else
+    {
+      /* rwlock_wake() makes us the writer when it wakes us. */
+      if (rw->stats != NULL)
+        wait_start = timer_now_ns ();
+      list_push_back (&rw->write_waiters, &cur->elem);
+      thread_block ();
+      ASSERT (rw->writer == cur);
+    }
+  if (rw->stats != NULL)
+    rw->acquire_time = stats_acquired (rw->stats, waited, wait_start);
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for
+   writing. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_for_write (rw));
+
+  old_level = intr_disable ();
+  if (rw->stats != NULL)
+    stats_released (rw->stats, rw->acquire_time);
+  rw->writer = NULL;
+  rwlock_wake (rw);
+  intr_set_level (old_level);
+
+  if (old_level == INTR_ON)
+    thread_yield_to_higher ();
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise. */
+bool
+rwlock_held_for_write (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
+
+/* Passes RW, which no thread holds, to the highest-priority
+   waiting writer, or if there is none to all of the waiting
+   readers.  Interrupts must be off. */
+static void
+rwlock_wake (struct rwlock *rw)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (rw->writer == NULL && rw->reader_cnt == 0);
+
+  if (!list_empty (&rw->write_waiters))
+    {
+      struct list_elem *e = list_max (&rw->write_waiters, thread_less, NULL);
+      list_remove (e);
+      rw->writer = list_entry (e, struct thread, elem);
+      thread_unblock (rw->writer);
+    }
+  else
+    while (!list_empty (&rw->read_waiters))
+      {
+        struct list_elem *e = list_pop_front (&rw->read_waiters);
+        rw->reader_cnt++;
+        thread_unblock (list_entry (e, struct thread, elem));
+      }
+}
+
+/* Initializes STATS and registers it under NAME, which must
+   remain valid, so that lock_print_stats() reports it.  Attach
+   it to locks with lock_set_stats() or rwlock_set_stats(). */
+void
+lock_stats_init (struct lock_stats *stats, const char *name)
+{
+  enum intr_level old_level;
+
+  ASSERT (stats != NULL);
+  ASSERT (name != NULL);
+
+  stats->name = name;
+  stats->acquire_cnt = 0;
+  stats->contended_cnt = 0;
+  stats->wait_ns = 0;
+  stats->max_hold_ns = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&all_lock_stats, &stats->elem);
+  intr_set_level (old_level);
+}
+
+/* Prints contention statistics for every registered lock that
+   has been acquired. */
+void
+lock_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_lock_stats); e != list_end (&all_lock_stats);
+       e = list_next (e))
+    {
+      struct lock_stats *s = list_entry (e, struct lock_stats, elem);
+
+      if (s->acquire_cnt > 0)
+        printf ("Lock %s: %llu acquires, %llu contended, "
+                "%lld us waiting, %lld us max hold\n",
+                s->name, s->acquire_cnt, s->contended_cnt,
+                s->wait_ns / 1000, s->max_hold_ns / 1000);
+    }
+}
+
+/* Records an acquisition in STATS and returns the current time.
+   If WAITED, the acquiring thread had to wait, starting at
+   WAIT_START.  Interrupts must be off. */
+static int64_t
+stats_acquired (struct lock_stats *stats, bool waited, int64_t wait_start)
+{
+  int64_t now = timer_now_ns ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  stats->acquire_cnt++;
+  if (waited)
+    {
+      stats->contended_cnt++;
+      stats->wait_ns += now - wait_start;
+    }
+  return now;
+}
+
+/* Records in STATS the release of a lock acquired at
+   ACQUIRE_TIME.  Interrupts must be off. */
+static void
+stats_released (struct lock_stats *stats, int64_t acquire_time)
+{
+  int64_t hold = timer_now_ns () - acquire_time;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (hold > stats->max_hold_ns)
+    stats->max_hold_ns = hold;
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem 
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on semaphore. */
   };
 
+/* Returns true if the thread waiting on semaphore_elem A has
+   lower priority than the one waiting on B. */
+static bool
+semaphore_elem_less (const struct list_elem *a_, const struct list_elem *b_,
+                     void *aux UNUSED)
+{
+  const struct semaphore_elem *a = list_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b = list_entry (b_, struct semaphore_elem, elem);
+
+  return a->thread->priority < b->thread->priority;
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -295,6 +698,7 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
@@ -302,7 +706,8 @@ cond_wait (struct condition *cond, struct lock *lock)
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
+   this function signals the one with the highest priority to
+   wake up from its wait.
    LOCK must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
@@ -317,8 +722,12 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      struct list_elem *e = list_max (&cond->waiters, semaphore_elem_less,
+                                      NULL);
+      list_remove (e);
+      sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+    }
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
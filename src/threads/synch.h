@@ -3,6 +3,7 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* A counting semaphore. */
 struct semaphore 
@@ -17,19 +18,60 @@ bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
 
+/* Contention statistics for one or more locks or reader-writer
+   locks, reported by lock_print_stats(). */
+struct lock_stats
+  {
+    const char *name;           /* Name to report. */
+    struct list_elem elem;      /* Element in list of all statistics. */
+    unsigned long long acquire_cnt;   /* # of acquisitions. */
+    unsigned long long contended_cnt; /* # of acquisitions that waited. */
+    int64_t wait_ns;            /* Total time spent waiting. */
+    int64_t max_hold_ns;        /* Longest time held exclusively. */
+  };
+
+void lock_stats_init (struct lock_stats *, const char *name);
+void lock_print_stats (void);
+
 /* Lock. */
 struct lock 
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    struct list_elem elem;      /* Element in holder's list of locks. */
+    int max_priority;           /* Highest priority donated through lock. */
+    struct lock_stats *stats;   /* Contention statistics, if any. */
+    int64_t acquire_time;       /* When holder acquired it, if stats. */
   };
 
 void lock_init (struct lock *);
+void lock_set_stats (struct lock *, struct lock_stats *);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* Reader-writer lock.  Any number of readers or a single writer
+   may hold it at a time.  Waiting writers take precedence over
+   new readers. */
+struct rwlock
+  {
+    unsigned reader_cnt;        /* # of threads holding it to read. */
+    struct thread *writer;      /* Thread holding it to write, if any. */
+    struct list read_waiters;   /* Threads waiting to read. */
+    struct list write_waiters;  /* Threads waiting to write. */
+    struct lock_stats *stats;   /* Contention statistics, if any. */
+    int64_t acquire_time;       /* When writer acquired it, if stats. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_set_stats (struct rwlock *, struct lock_stats *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 /* Condition variable. */
 struct condition 
   {
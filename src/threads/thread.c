@@ -22,17 +22,36 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running.  There is one FIFO list
+   per priority, and bit P of ready_mask is set exactly when
+   ready_lists[P] is nonempty, so that finding the highest-priority
+   ready thread takes constant time. */
+static struct list ready_lists[PRI_MAX + 1];
+static uint64_t ready_mask;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-
-/* List of all process waiting to be waked up */
-static struct list wait_list;
+/* Sleeping threads, in a hierarchical timing wheel keyed by
+   wakeup tick.  Level L has WHEEL_SIZE buckets, each covering
+   WHEEL_SIZE**L ticks, so level 0 holds threads that wake within
+   the next WHEEL_SIZE ticks, level 1 those that wake within the
+   next WHEEL_SIZE**2 ticks, and so on.  Threads further away than
+   the top level can reach wait in sleep_overflow.  As time
+   reaches each level-L bucket, its threads are redistributed
+   ("cascaded") into lower levels, so sleeping is O(1) and each
+   tick wakes the threads in a single level-0 bucket. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+static struct list sleep_wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static struct list sleep_overflow;
+
+/* Next tick whose sleepers have not yet been woken. */
+static int64_t wheel_tick;
 
 
 /* Idle thread. */
@@ -60,6 +79,11 @@ static long long user_ticks;    /* # of timer ticks in user programs. */
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+static int ready_cnt;           /* # of threads in ready_lists. */
+
+/* Multi-level feedback queue scheduler. */
+#define PRIORITY_INTERVAL 4     /* # of ticks between priority updates. */
+static fixed_point load_avg;    /* Estimated # of threads ready to run. */
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
@@ -78,41 +102,15 @@ static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
 
-bool wakeup_order (const struct list_elem *a,
-                  const struct list_elem *b,void *aux);
-bool priority_order (const struct list_elem *a,
-                    const struct list_elem *b,void *aux);
-
-
-
-bool wakeup_order (const struct list_elem *a,
-                  const struct list_elem *b,void *aux UNUSED)
-{
-  struct thread *thread_1 = list_entry (a, struct thread, wtelem);
-  struct thread *thread_2 = list_entry (b, struct thread, wtelem);
-
-  if( thread_1->priority > thread_2->priority )
-    return true;
-  else
-    {
-      if( thread_1->priority == thread_2->priority && thread_1->wakeup_tick < thread_2->wakeup_tick)
-        return true;
-      else
-        return false;
-    }
-}
-
-
-bool priority_order (const struct list_elem *a,
-                    const struct list_elem *b,void *aux UNUSED)
-{
-  struct thread *thread_1 = list_entry (a, struct thread, elem);
-  struct thread *thread_2 = list_entry (b, struct thread, elem);
-
-  return thread_1->priority > thread_2->priority;
-}
-
-
+static void wheel_insert (struct thread *);
+static void wheel_cascade (struct list *);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static int ready_max_priority (void);
+static void change_priority (struct thread *, int priority);
+static void mlfqs_tick (void);
+static void mlfqs_update_priority (struct thread *, void *aux);
+static void mlfqs_update_recent_cpu (struct thread *, void *aux);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -130,12 +128,22 @@ bool priority_order (const struct list_elem *a,
 void
 thread_init (void) 
 {
+  int level, i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&ready_lists[i]);
+  ready_mask = 0;
+  ready_cnt = 0;
+  load_avg = 0;
   list_init (&all_list);
-  list_init (&wait_list);
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (i = 0; i < WHEEL_SIZE; i++)
+      list_init (&sleep_wheel[level][i]);
+  list_init (&sleep_overflow);
+  wheel_tick = 0;
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -181,93 +189,164 @@ thread_tick (void)
   // unblock blocked threads
   thread_wakeup();
 
+  if (thread_mlfqs)
+    mlfqs_tick ();
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
 }
 
-/**
- * @brief thread_wakeup
- * Check through the waiting threads if the waiting time has expired
- * if so, the thread is unblocked
- *
- * @param tick number of ticks passed since the kernel initialization
- */
+/* Accounts for CNT timer ticks that passed without a timer
+   interrupt while only the idle thread could run.  Used by
+   tickless idle. */
 void
-thread_wakeup(void)
+thread_tick_idle (int64_t cnt)
 {
-  enum intr_level old_level;
-  old_level = intr_disable ();
+  ASSERT (intr_get_level () == INTR_OFF);
+  idle_ticks += cnt;
+}
 
+/* Returns the number of timer ticks, from 1 up to MAX, until the
+   next tick on which thread_tick() has work to do even though
+   only the idle thread can run: waking a sleeping thread,
+   cascading the timing wheel, or updating the multi-level
+   feedback queue scheduler's load average.  Used by tickless
+   idle. */
+int64_t
+thread_ticks_until_work (int64_t max)
+{
+  int64_t n;
 
-  struct thread *t;
-  struct list_elem *elem = list_begin (&wait_list);
-  for (; elem != list_end (&wait_list); elem = list_next (elem))
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (n = 1; n < max; n++)
     {
-      t = list_entry (elem, struct thread, wtelem);
+      /* The tick that would end an idle period of N ticks. */
+      int64_t tick = wheel_tick + n - 1;
 
-      if( t->wakeup_tick > timer_ticks() )
-          break;
+      if ((tick & WHEEL_MASK) == 0
+          || !list_empty (&sleep_wheel[0][tick & WHEEL_MASK])
+          || (thread_mlfqs && tick % TIMER_FREQ == 0))
+        break;
+    }
+  return n;
+}
 
-      //printf("Thread: %s with %lld P(%i)\n", t->name, t->wakeup_tick, t->priority);
+/* Wakes up every sleeping thread whose wakeup tick has
+   arrived, and yields on return from the interrupt if one of
+   them outranks the running thread.  Called by the timer
+   interrupt handler, via thread_tick(), once per tick. */
+void
+thread_wakeup (void)
+{
+  int64_t now = timer_ticks ();
+  enum intr_level old_level;
+  bool woke = false;
 
-      thread_unblock(t);
-      list_remove(elem);
-    }
+  ASSERT (intr_context ());
 
+  old_level = intr_disable ();
+  for (; wheel_tick <= now; wheel_tick++)
+    {
+      size_t idx = wheel_tick & WHEEL_MASK;
+      struct list *bucket;
+
+      /* Each time a level wraps around, move the threads in the
+         next bucket of the level above down into it. */
+      if (idx == 0)
+        {
+          int level;
+
+          for (level = 1; level < WHEEL_LEVELS; level++)
+            {
+              size_t upper = (wheel_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+              wheel_cascade (&sleep_wheel[level][upper]);
+              if (upper != 0)
+                break;
+            }
+          if (level == WHEEL_LEVELS)
+            wheel_cascade (&sleep_overflow);
+        }
+
+      bucket = &sleep_wheel[0][idx];
+      while (!list_empty (bucket))
+        {
+          struct thread *t = list_entry (list_pop_front (bucket),
+                                         struct thread, wtelem);
+          thread_unblock (t);
+          woke = true;
+        }
+    }
+  if (woke && ready_max_priority () > thread_current ()->priority)
+    intr_yield_on_return ();
   intr_set_level (old_level);
 }
 
-
-/**
- * @brief thread_sleep
- * puts the current thread in the sleep thread list and changes it state
- * to blocked.
- * @param ticks number of ticks at wake up
- */
+/* Blocks the current thread until timer tick WAKEUP_TICK.
+   Returns immediately if that tick has already passed. */
 void
-thread_sleep(int64_t ticks)
+thread_sleep (int64_t wakeup_tick)
 {
-  // should not happen
-  if( ticks < 0 )
-      return;
-
   enum intr_level old_level;
-  old_level = intr_disable ();
 
-  struct thread *current_thread = thread_current();
-  current_thread->wakeup_tick = ticks;
-  list_insert_ordered(&wait_list, &current_thread->wtelem, wakeup_order, NULL);
+  old_level = intr_disable ();
+  if (wakeup_tick >= wheel_tick)
+    {
+      struct thread *cur = thread_current ();
+      cur->wakeup_tick = wakeup_tick;
+      wheel_insert (cur);
+      thread_block ();
+    }
+  intr_set_level (old_level);
+}
 
-  //thread_print_stats();
+/* Adds sleeping thread T to the bucket of the timing wheel that
+   covers its wakeup tick. */
+static void
+wheel_insert (struct thread *t)
+{
+  int64_t delta = t->wakeup_tick - wheel_tick;
+  struct list *bucket = &sleep_overflow;
+  int level;
 
-  thread_block();
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  intr_set_level (old_level);
+  if (delta < 0)
+    delta = 0;
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      {
+        size_t idx = (t->wakeup_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        if (t->wakeup_tick < wheel_tick)
+          idx = wheel_tick & WHEEL_MASK;
+        bucket = &sleep_wheel[level][idx];
+        break;
+      }
+  list_push_back (bucket, &t->wtelem);
 }
 
+/* Reinserts every thread in BUCKET into the timing wheel, which
+   moves each one to a lower level. */
+static void
+wheel_cascade (struct list *bucket)
+{
+  struct list threads;
+
+  list_init (&threads);
+  while (!list_empty (bucket))
+    list_push_back (&threads, list_pop_front (bucket));
+  while (!list_empty (&threads))
+    wheel_insert (list_entry (list_pop_front (&threads),
+                              struct thread, wtelem));
+}
 
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
 {
-
-   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
+  printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
-
-  printf("Added: %s with %lld | List Size: %i | CT %lld\n", thread_current()->name,thread_current()->wakeup_tick, list_size(&wait_list), timer_ticks());
-
-  printf("Queue (%i)\n", list_size(&wait_list));
-  struct thread *t;
-  struct list_elem *elem = list_begin (&wait_list);
-  for (; elem != list_end (&wait_list); elem = list_next (elem))
-    {
-      t = list_entry (elem, struct thread, wtelem);
-      printf("Thread: %s with %lld P(%i)\n", t->name, t->wakeup_tick, t->priority);
-    }
-  printf("\n");
-
-
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -303,9 +382,17 @@ thread_create (const char *name, int priority,
   if (t == NULL)
     return TID_ERROR;
 
-  /* Initialize thread. */
+  /* Initialize thread.  Under the multi-level feedback queue
+     scheduler, it inherits its creator's niceness and recent CPU
+     time, and these determine its priority. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+  if (thread_mlfqs)
+    {
+      t->nice = thread_current ()->nice;
+      t->recent_cpu = thread_current ()->recent_cpu;
+      mlfqs_update_priority (t, NULL);
+    }
 
   /* Prepare thread for first run by initializing its stack.
      Do this atomically so intermediate values for the 'stack' 
@@ -329,8 +416,9 @@ thread_create (const char *name, int priority,
 
   intr_set_level (old_level);
 
-  /* Add to run queue. */
+  /* Add to run queue, and run it now if it outranks us. */
   thread_unblock (t);
+  thread_yield_to_higher ();
 
   return tid;
 }
@@ -373,7 +461,7 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_insert_ordered(&ready_list, &t->elem, priority_order, NULL);
+  ready_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
 }
@@ -444,12 +532,31 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_insert_ordered(&ready_list, &cur->elem, priority_order,NULL);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
 }
 
+/* Yields the CPU if a ready thread has a higher priority than
+   the running thread.  In an interrupt handler, yields on return
+   from the interrupt instead. */
+void
+thread_yield_to_higher (void)
+{
+  enum intr_level old_level = intr_disable ();
+  bool outranked = ready_max_priority () > thread_current ()->priority;
+  intr_set_level (old_level);
+
+  if (outranked)
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -467,56 +574,212 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/** Sets the current thread's priority to NEW_PRIORITY.
- * a thread must yield the CPU if when lowering its priority
- * it no longer has the highest priority
- */
+/* Sets the current thread's priority to NEW_PRIORITY.  Priority
+   donated to the thread still applies until the locks it was
+   donated through are released.  Yields if the thread no longer
+   has the highest priority. */
 void
 thread_set_priority (int new_priority)
 {
-  struct thread *t = thread_current();
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  /* The multi-level feedback queue scheduler sets priorities
+     itself. */
+  if (thread_mlfqs)
+    return;
 
-  printf("Thread %s P_%i\n", t->name, t->priority);
-  t->priority = new_priority;
-  printf("Thread %s P_%i\n\n", t->name, t->priority);
+  old_level = intr_disable ();
+  cur->original_priority = new_priority;
+  thread_refresh_priority (cur);
+  if (ready_max_priority () > cur->priority)
+    thread_yield ();
+  intr_set_level (old_level);
 }
 
-/** Returns the current thread's priority. */
+/* Returns the current thread's priority, including any priority
+   donated to it. */
 int
 thread_get_priority (void) 
 {
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Raises T's priority to PRIORITY, if it is lower, because a
+   thread of that priority is waiting for a lock that T holds.
+   Interrupts must be off. */
+void
+thread_donate_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (priority > t->priority)
+    change_priority (t, priority);
+}
+
+/* Recomputes T's priority as the higher of its own priority and
+   the highest priority donated through any lock it holds.
+   Interrupts must be off. */
+void
+thread_refresh_priority (struct thread *t)
+{
+  int priority = t->original_priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->locks); e != list_end (&t->locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      if (lock->max_priority > priority)
+        priority = lock->max_priority;
+    }
+  change_priority (t, priority);
+}
+
+/* Returns true if thread A, given its `elem', has lower priority
+   than thread B. */
+bool
+thread_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->priority < b->priority;
+}
+
+/* Sets T's priority to PRIORITY, moving it to the matching ready
+   list if it is ready.  Interrupts must be off. */
+static void
+change_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  if (priority == t->priority)
+    return;
+  if (t->status == THREAD_READY)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
+}
+
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest
+   priority. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  mlfqs_update_priority (cur, NULL);
+  if (ready_max_priority () > cur->priority)
+    thread_yield ();
+  intr_set_level (old_level);
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load_avg_100 = fp_round (fp_mul_int (load_avg, 100));
+  intr_set_level (old_level);
+  return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent_cpu_100 = fp_round (fp_mul_int (thread_current ()->recent_cpu,
+                                             100));
+  intr_set_level (old_level);
+  return recent_cpu_100;
+}
+
+/* Does the per-tick bookkeeping of the multi-level feedback
+   queue scheduler.  Only the running thread's recent_cpu changes
+   from tick to tick, so only its priority is recomputed every
+   PRIORITY_INTERVAL ticks.  Once per second, the load average
+   and every thread's recent_cpu and priority are recomputed. */
+static void
+mlfqs_tick (void)
+{
+  struct thread *cur = thread_current ();
+  int64_t ticks = timer_ticks ();
+
+  ASSERT (intr_context ());
+
+  if (cur != idle_thread)
+    cur->recent_cpu = fp_add_int (cur->recent_cpu, 1);
+
+  if (ticks % TIMER_FREQ == 0)
+    {
+      int ready_threads = ready_cnt + (cur != idle_thread);
+
+      load_avg = fp_add (fp_mul (fp_div_int (fp_from_int (59), 60), load_avg),
+                         fp_div_int (fp_from_int (ready_threads), 60));
+      thread_foreach (mlfqs_update_recent_cpu, NULL);
+      thread_foreach (mlfqs_update_priority, NULL);
+    }
+  else if (ticks % PRIORITY_INTERVAL == 0)
+    mlfqs_update_priority (cur, NULL);
+
+  if (ready_max_priority () > cur->priority)
+    intr_yield_on_return ();
+}
+
+/* Recomputes the recent_cpu of thread T, decaying it according
+   to the load average. */
+static void
+mlfqs_update_recent_cpu (struct thread *t, void *aux UNUSED)
+{
+  fixed_point twice_load = fp_mul_int (load_avg, 2);
+  fixed_point decay = fp_div (twice_load, fp_add_int (twice_load, 1));
+
+  if (t != idle_thread)
+    t->recent_cpu = fp_add_int (fp_mul (decay, t->recent_cpu), t->nice);
+}
+
+/* Recomputes the priority of thread T from its recent_cpu and
+   niceness, moving it to the right ready list if it is ready. */
+static void
+mlfqs_update_priority (struct thread *t, void *aux UNUSED)
+{
+  int priority;
+
+  if (t == idle_thread)
+    return;
+
+  priority = PRI_MAX - fp_trunc (fp_div_int (t->recent_cpu, 4)) - t->nice * 2;
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+
+  change_priority (t, priority);
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -541,6 +804,9 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Skip timer ticks that have nothing to do, if enabled. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -602,9 +868,11 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->original_priority = priority;
+  list_init (&t->locks);
+  t->nice = NICE_DEFAULT;
   t->magic = THREAD_MAGIC;
-  list_insert_ordered(&all_list, &t->allelem, priority_order, NULL);
+  list_push_back (&all_list, &t->allelem);
 }
 
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
@@ -628,10 +896,63 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int priority = ready_max_priority ();
+  struct list *list;
+  struct thread *t;
+
+  if (priority < 0)
     return idle_thread;
+
+  list = &ready_lists[priority];
+  t = list_entry (list_pop_front (list), struct thread, elem);
+  if (list_empty (list))
+    ready_mask &= ~((uint64_t) 1 << priority);
+  ready_cnt--;
+  return t;
+}
+
+/* Adds T to the back of the ready list for its priority.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  list_push_back (&ready_lists[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Removes ready thread T from its ready list.  Interrupts must be
+   off. */
+static void
+ready_remove (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_lists[t->priority]))
+    ready_mask &= ~((uint64_t) 1 << t->priority);
+  ready_cnt--;
+}
+
+/* Returns the priority of the highest-priority ready thread, or
+   -1 if no thread is ready.  Interrupts must be off. */
+static int
+ready_max_priority (void)
+{
+  uint32_t high = ready_mask >> 32;
+  uint32_t low = ready_mask;
+
+  /* __builtin_clz() compiles to a single BSR instruction. */
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  else if (low != 0)
+    return 31 - __builtin_clz (low);
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    return -1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -698,6 +1019,10 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
+  /* Catch up on timer ticks skipped while idle. */
+  if (cur == idle_thread)
+    timer_idle_exit ();
+
   if (cur != next)
     prev = switch_threads (cur, next);
   thread_schedule_tail (prev);
@@ -4,6 +4,10 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include <fixed-point.h>
+#ifdef VM
+#include <hash.h>
+#endif
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -24,6 +28,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness. */
+#define NICE_MIN -20                    /* Nicest. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -88,28 +97,44 @@ struct thread
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
 
-    int original_priority;
-    int priority;                       /* Priority. */
+    int original_priority;              /* Priority before donations. */
+    int priority;                       /* Priority, including donations. */
+    struct list locks;                  /* Locks held, for donation. */
+    struct lock *waiting_lock;          /* Lock being waited for. */
+    int nice;                           /* Niceness, for -mlfqs. */
+    fixed_point recent_cpu;             /* Recent CPU time, for -mlfqs. */
     struct list_elem allelem;           /* List element for all threads list. */
 
-    struct list_elem wtelem;            /* List element waiting thread list */
+    struct list_elem wtelem;            /* List element in sleep queue. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
 
-
-    struct list_elem files;             /* openfiles -> userprog */
-
   #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+  #ifdef VM
+    struct file *exec_file;             /* Executable, for demand paging. */
+
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+  #endif
+
+    /* Owned by userprog/syscall.c. */
+    struct file **fds;                  /* Open files, indexed by fd. */
+    int fd_cnt;                         /* Number of slots in fds. */
+  #ifdef VM
+    struct mapping **mappings;          /* Mapped files, indexed by mapid. */
+    int mapping_cnt;                    /* Number of slots in mappings. */
+    void *user_esp;                     /* User stack pointer on entry to
+                                           the current system call. */
+  #endif
   #endif
 
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
 
-    /* time to wakeup */
-    int64_t wakeup_tick;
+    int64_t wakeup_tick;                /* Tick to wake up, if sleeping. */
   };
 
 
@@ -122,6 +147,8 @@ void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_tick_idle (int64_t cnt);
+int64_t thread_ticks_until_work (int64_t max);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -139,6 +166,7 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_yield_to_higher (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -146,6 +174,10 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_donate_priority (struct thread *, int priority);
+bool thread_less (const struct list_elem *, const struct list_elem *,
+                  void *aux);
+void thread_refresh_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
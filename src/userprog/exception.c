@@ -4,6 +4,9 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,9 +151,24 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef VM
+  /* Bring in the page if it belongs to the process but is not
+     in memory: not loaded yet, or evicted since.  Otherwise, grow
+     the stack if this looks like a stack access.  This also
+     covers the kernel touching user memory in a system call,
+     when the user stack pointer is the one saved on entry.
+     Buffers passed to the file system are pinned in memory
+     instead, by page_pin(), because they would fault with file
+     system locks held. */
+  if (not_present)
+    {
+      void *esp = user ? f->esp : thread_current ()->user_esp;
+
+      if (page_load (fault_addr) || page_grow_stack (fault_addr, esp))
+        return;
+    }
+#endif
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
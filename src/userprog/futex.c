@@ -0,0 +1,202 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Fast user-space mutexes.
+
+   A futex is an int in user memory.  User code manipulates it
+   with atomic instructions and calls into the kernel only to
+   sleep until the int changes (futex_wait()) or to wake sleepers
+   after changing it (futex_wake()).  Futexes are identified by
+   the physical address of the int, so that processes that map
+   the same physical page share them.
+
+   With virtual memory, a page may move to a different frame
+   while threads wait on it, so futexes are instead identified
+   by what the page holds.  Processes share writable memory by
+   mapping the same file with mmap, so a futex in a mapped file
+   is identified by the file's inode and its offset in the file.
+   Any other futex is private to its process and is identified
+   by address space and user virtual address. */
+
+/* Number of hash buckets for waiting threads. */
+#define FUTEX_BUCKET_CNT 64
+
+/* Identifies a futex. */
+struct futex_key
+  {
+    const void *space;          /* Page directory or inode, or a null
+                                   pointer for physical memory. */
+    uintptr_t addr;             /* Address or offset within it. */
+  };
+
+/* A thread sleeping in futex_wait(). */
+struct futex_waiter
+  {
+    struct list_elem elem;      /* Element in bucket's waiters list. */
+    struct futex_key key;       /* Futex waited on. */
+    struct semaphore sema;      /* Upped to wake the thread. */
+  };
+
+/* A hash bucket.  Waiters for every futex whose key hashes to
+   the bucket wait in the same list, in FIFO order. */
+struct futex_bucket
+  {
+    struct lock lock;           /* Protects waiters. */
+    struct list waiters;        /* List of struct futex_waiter. */
+  };
+
+static struct futex_bucket buckets[FUTEX_BUCKET_CNT];
+
+static struct futex_key futex_key (int *uaddr);
+static bool same_key (struct futex_key, struct futex_key);
+static struct futex_bucket *futex_bucket (struct futex_key);
+
+/* Initializes the futex wait queues. */
+void
+futex_init (void)
+{
+  size_t i;
+
+  for (i = 0; i < FUTEX_BUCKET_CNT; i++)
+    {
+      lock_init (&buckets[i].lock);
+      list_init (&buckets[i].waiters);
+    }
+}
+
+/* If the futex at UADDR still contains EXPECTED, sleeps until
+   another thread wakes it with futex_wake() and returns 0.
+   Otherwise, returns -1 without sleeping.  UADDR must be a
+   4-byte aligned address in mapped user memory. */
+int
+futex_wait (int *uaddr, int expected)
+{
+  struct futex_waiter w;
+  struct futex_bucket *b;
+  bool changed;
+
+  w.key = futex_key (uaddr);
+  sema_init (&w.sema, 0);
+  b = futex_bucket (w.key);
+
+#ifdef VM
+  /* Keep the futex in memory while we read it, so that the read
+     cannot fault with the bucket lock held. */
+  if (!page_pin (uaddr))
+    return -1;
+#endif
+
+  /* Checking the value and queuing under the bucket lock makes
+     the two atomic with respect to futex_wake(), so a wakeup
+     that follows a change to the futex cannot be missed. */
+  lock_acquire (&b->lock);
+  changed = *uaddr != expected;
+  if (!changed)
+    list_push_back (&b->waiters, &w.elem);
+  lock_release (&b->lock);
+
+#ifdef VM
+  page_unpin (uaddr);
+#endif
+  if (changed)
+    return -1;
+
+  sema_down (&w.sema);
+  return 0;
+}
+
+/* Wakes up to CNT threads, longest-waiting first, that are
+   sleeping on the futex at UADDR.  Returns the number woken.
+   UADDR must be a 4-byte aligned address in mapped user
+   memory. */
+int
+futex_wake (int *uaddr, int cnt)
+{
+  struct futex_key key = futex_key (uaddr);
+  struct futex_bucket *b = futex_bucket (key);
+  struct list_elem *e;
+  int woken = 0;
+
+  lock_acquire (&b->lock);
+  for (e = list_begin (&b->waiters);
+       e != list_end (&b->waiters) && woken < cnt; )
+    {
+      struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+
+      if (same_key (w->key, key))
+        {
+          e = list_remove (e);
+          sema_up (&w->sema);
+          woken++;
+        }
+      else
+        e = list_next (e);
+    }
+  lock_release (&b->lock);
+
+  return woken;
+}
+
+/* Returns the key for the futex at UADDR: its physical address,
+   expressed as the kernel virtual address that maps it, or under
+   virtual memory its inode and offset if it is in a mapped file
+   and otherwise its user virtual address in the current
+   process. */
+static struct futex_key
+futex_key (int *uaddr)
+{
+  struct futex_key key;
+
+  ASSERT ((uintptr_t) uaddr % sizeof *uaddr == 0);
+
+#ifdef VM
+  {
+    struct inode *inode;
+    off_t ofs;
+
+    if (page_mapped_file (uaddr, &inode, &ofs))
+      {
+        key.space = inode;
+        key.addr = ofs;
+      }
+    else
+      {
+        key.space = thread_current ()->pagedir;
+        key.addr = (uintptr_t) uaddr;
+      }
+  }
+#else
+  {
+    uint8_t *kpage = pagedir_get_page (thread_current ()->pagedir, uaddr);
+
+    ASSERT (kpage != NULL);
+    key.space = NULL;
+    key.addr = (uintptr_t) pg_round_down (kpage) + pg_ofs (uaddr);
+  }
+#endif
+  return key;
+}
+
+/* Returns true if A and B identify the same futex. */
+static bool
+same_key (struct futex_key a, struct futex_key b)
+{
+  return a.space == b.space && a.addr == b.addr;
+}
+
+/* Returns the hash bucket for futex KEY. */
+static struct futex_bucket *
+futex_bucket (struct futex_key key)
+{
+  return &buckets[hash_bytes (&key, sizeof key) % FUTEX_BUCKET_CNT];
+}
@@ -7,6 +7,7 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -17,6 +18,9 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
@@ -133,11 +137,22 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  /* Close the process's open files. */
+  syscall_close_all ();
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
   if (pd != NULL) 
     {
+#ifdef VM
+      /* Release the process's pages while its page directory
+         still maps them, then the executable that backs them. */
+      page_table_destroy ();
+      file_close (cur->exec_file);
+      cur->exec_file = NULL;
+#endif
+
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
@@ -254,6 +269,14 @@ load (const char *file_name, void (**eip) (void), void **esp)
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
+#ifdef VM
+  if (!page_table_init ())
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      goto done;
+    }
+#endif
   process_activate ();
 
   /* Open executable file. */
@@ -347,13 +370,25 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
  done:
   /* We arrive here whether the load is successful or not. */
+#ifdef VM
+  /* Pages of the executable are read when first touched, so
+     keep it open, and unmodifiable, while the process runs. */
+  if (success)
+    {
+      file_deny_write (file);
+      t->exec_file = file;
+      return success;
+    }
+#endif
   file_close (file);
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -412,6 +447,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table here, and are read in from FILE when
+   the process first touches them.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -422,6 +461,24 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  while (read_bytes > 0 || zero_bytes > 0) 
+    {
+      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+      size_t page_zero_bytes = PGSIZE - page_read_bytes;
+
+      if (page_read_bytes > 0
+          ? !page_add_file (upage, file, ofs, page_read_bytes, writable)
+          : !page_add_zero (upage, writable))
+        return false;
+
+      read_bytes -= page_read_bytes;
+      zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
+      upage += PGSIZE;
+    }
+  return true;
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -457,6 +514,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -464,8 +522,15 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp) 
 {
-  uint8_t *kpage;
   bool success = false;
+#ifdef VM
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+
+  success = page_add_zero (upage, true) && page_load (upage);
+  if (success)
+    *esp = PHYS_BASE - 12;  // step 3.2
+#else
+  uint8_t *kpage;
 
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL) 
@@ -476,6 +541,7 @@ setup_stack (void **esp)
       else
         palloc_free_page (kpage);
     }
+#endif
   return success;
 }
 
@@ -488,6 +554,7 @@ setup_stack (void **esp)
    with palloc_get_page().
    Returns true on success, false if UPAGE is already mapped or
    if memory allocation fails. */
+#ifndef VM
 static bool
 install_page (void *upage, void *kpage, bool writable)
 {
@@ -498,3 +565,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
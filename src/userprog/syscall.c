@@ -1,442 +1,594 @@
 #include "userprog/syscall.h"
+#include <round.h>
 #include <stdio.h>
 #include <syscall-nr.h>
-#include "threads/interrupt.h"
-#include "threads/thread.h"
+#include "devices/input.h"
 #include "devices/shutdown.h"
-#include "filesys/filesys.h"
+#include "devices/timer.h"
 #include "filesys/file.h"
-#include "filesys/inode.h"
+#include "filesys/filesys.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/futex.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Lowest file descriptor handed out for files.  0 and 1 are the
+   console. */
+#define FIRST_FILE_FD 2
+
+/* Initial number of slots in a process's file descriptor table. */
+#define INITIAL_FD_CNT 16
+
+#ifdef VM
+/* Initial number of slots in a process's mapping table. */
+#define INITIAL_MAPPING_CNT 4
+
+/* A file mapped into memory by mmap. */
+struct mapping
+  {
+    struct file *file;          /* File reopened for the mapping. */
+    uint8_t *base;              /* First mapped page. */
+    size_t page_cnt;            /* Number of mapped pages. */
+  };
+#endif
+
+/* Serializes file system operations that modify the file
+   system.  Operations that only read it may run concurrently. */
+static struct rwlock filesys_lock;
+static struct lock_stats filesys_lock_stats;
 
 static void syscall_handler (struct intr_frame *);
-static int exec(const char*);
-static int exit(int);
-static int create(const char *, unsigned);
-static int open(const char*);
-static int halt();
-static int close(int);
-static int filesize(int);
-static int write(int,const void *, unsigned);
-static int seek(int, unsigned);
-static int remove(const char *);
-static int tell(int);
-static int wait(int);
-static int read(int, void*,unsigned);
-
-static int get_next_fd();
-
-/**
- * add something to wait list
- */
-static struct list pid_wait;
-
-
-/**
- * add something file descriptors
- * fd 0 (STDIN_FILENO) is standard input,
- * fd 1 (STDOUT_FILENO) is standard output.
- */
-static int next_fd;
-
-/*
- * structure to associate file to the process/thread
- * and to keep track of all open files
- */
-struct fdelem {
-  int fd;
-  struct file *file;
-  struct list_elem thread_elem;
-  struct list_elem of_elem;
-};
-
-static struct list open_files;
+static uint32_t get_arg (const struct intr_frame *, int idx);
+static void check_user (const void *uaddr, size_t size);
+static void check_writable (void *uaddr, size_t size);
+static off_t file_io (struct file *, uint8_t *buffer, size_t size,
+                      bool write);
+static off_t locked_file_io (struct file *, void *buffer, size_t size,
+                             bool write);
+static void check_string (const char *);
+static void check_futex (int *);
+static void sys_exit (int status) NO_RETURN;
+static int alloc_fd (struct file *);
+static struct file *lookup_fd (int fd);
+#ifdef VM
+static int sys_mmap (int fd, void *addr);
+static int alloc_mapid (struct mapping *);
+static void sys_munmap (int mapid);
+static void unmap (struct mapping *);
+#endif
 
-
-/**
- * @brief syscall_init
- */
 void
-syscall_init (void) 
+syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
+  rwlock_init (&filesys_lock);
+  lock_stats_init (&filesys_lock_stats, "file system");
+  rwlock_set_stats (&filesys_lock, &filesys_lock_stats);
+  futex_init ();
+}
+
+/* Removes every mapping that the current process has, closes
+   every file that it has open, and frees its file descriptor
+   table. */
+void
+syscall_close_all (void)
+{
+  struct thread *cur = thread_current ();
+  int fd;
 
-  next_fd = 2;
-  list_init(&open_files);
-  list_init(&pid_wait);
+#ifdef VM
+  if (cur->mappings != NULL)
+    {
+      int mapid;
+
+      for (mapid = 0; mapid < cur->mapping_cnt; mapid++)
+        if (cur->mappings[mapid] != NULL)
+          unmap (cur->mappings[mapid]);
+      free (cur->mappings);
+      cur->mappings = NULL;
+      cur->mapping_cnt = 0;
+    }
+#endif
+
+  if (cur->fds == NULL)
+    return;
+
+  rwlock_acquire_write (&filesys_lock);
+  for (fd = FIRST_FILE_FD; fd < cur->fd_cnt; fd++)
+    file_close (cur->fds[fd]);
+  rwlock_release_write (&filesys_lock);
+
+  free (cur->fds);
+  cur->fds = NULL;
+  cur->fd_cnt = 0;
 }
 
 static void
 syscall_handler (struct intr_frame *f)
 {
-  int ret;
-  int *p = f->esp;
+  uint32_t arg0, arg1, arg2;
+  struct file *file;
 
-  if( !(is_user_vaddr(*(p+1)) && is_user_vaddr(*(p+2)) && is_user_vaddr(*(p+3))) )
+#ifdef VM
+  /* A fault on user memory in the kernel needs this to tell
+     whether the stack should grow. */
+  thread_current ()->user_esp = f->esp;
+#endif
+
+  switch (get_arg (f, -1))
     {
-      exit(-1);
-    }
+    case SYS_HALT:
+      shutdown_power_off ();
 
+    case SYS_EXIT:
+      sys_exit (get_arg (f, 0));
 
+    case SYS_EXEC:
+      arg0 = get_arg (f, 0);
+      check_string ((const char *) arg0);
+      f->eax = process_execute ((const char *) arg0);
+      break;
 
-  switch(*p)
-    {
-    case SYS_HALT:                   /* Halt the operating system. */
-      ret = halt();
+    case SYS_WAIT:
+      f->eax = process_wait (get_arg (f, 0));
       break;
-    case SYS_EXIT:                   /* Terminate this process. */
-      ret = exit(*(p+1));
+
+    case SYS_CREATE:
+      arg0 = get_arg (f, 0);
+      arg1 = get_arg (f, 1);
+      check_string ((const char *) arg0);
+      rwlock_acquire_write (&filesys_lock);
+      f->eax = filesys_create ((const char *) arg0, arg1);
+      rwlock_release_write (&filesys_lock);
+      break;
+
+    case SYS_REMOVE:
+      arg0 = get_arg (f, 0);
+      check_string ((const char *) arg0);
+      rwlock_acquire_write (&filesys_lock);
+      f->eax = filesys_remove ((const char *) arg0);
+      rwlock_release_write (&filesys_lock);
       break;
-    case SYS_EXEC:                   /* Start another process. */
-      ret = exec(*(p+1));
+
+    case SYS_OPEN:
+      arg0 = get_arg (f, 0);
+      check_string ((const char *) arg0);
+      rwlock_acquire_read (&filesys_lock);
+      file = filesys_open ((const char *) arg0);
+      f->eax = file != NULL ? alloc_fd (file) : -1;
+      if (file != NULL && (int) f->eax < 0)
+        file_close (file);
+      rwlock_release_read (&filesys_lock);
       break;
-    case SYS_WAIT:                   /* Wait for a child process to die. */
-      ret = wait(*(p+1);
+
+    case SYS_FILESIZE:
+      file = lookup_fd (get_arg (f, 0));
+      rwlock_acquire_read (&filesys_lock);
+      f->eax = file_length (file);
+      rwlock_release_read (&filesys_lock);
       break;
-    case SYS_CREATE:                 /* Create a file. */
-      ret = create(*(p+1),*(p+2));
+
+    case SYS_READ:
+      arg0 = get_arg (f, 0);
+      arg1 = get_arg (f, 1);
+      arg2 = get_arg (f, 2);
+      check_writable ((void *) arg1, arg2);
+      if (arg0 == STDIN_FILENO)
+        {
+          uint8_t *buffer = (uint8_t *) arg1;
+          size_t i;
+
+          for (i = 0; i < arg2; i++)
+            buffer[i] = input_getc ();
+          f->eax = arg2;
+          break;
+        }
+      f->eax = file_io (lookup_fd (arg0), (void *) arg1, arg2, false);
       break;
-    case SYS_REMOVE:                 /* Delete a file. */
-      ret = remove(*(p+1));
+
+    case SYS_WRITE:
+      arg0 = get_arg (f, 0);
+      arg1 = get_arg (f, 1);
+      arg2 = get_arg (f, 2);
+      check_user ((const void *) arg1, arg2);
+      if (arg0 == STDOUT_FILENO)
+        {
+          putbuf ((const char *) arg1, arg2);
+          f->eax = arg2;
+          break;
+        }
+      f->eax = file_io (lookup_fd (arg0), (void *) arg1, arg2, true);
       break;
-    case SYS_OPEN:                   /* Open a file. */
-      ret = open(*(p+1));
+
+    case SYS_SEEK:
+      arg1 = get_arg (f, 1);
+      file = lookup_fd (get_arg (f, 0));
+      rwlock_acquire_read (&filesys_lock);
+      file_seek (file, arg1);
+      rwlock_release_read (&filesys_lock);
       break;
-    case SYS_FILESIZE:               /* Obtain a file's size. */
-      ret = filesize(*(p+1));
+
+    case SYS_TELL:
+      file = lookup_fd (get_arg (f, 0));
+      rwlock_acquire_read (&filesys_lock);
+      f->eax = file_tell (file);
+      rwlock_release_read (&filesys_lock);
       break;
-    case SYS_READ:                   /* Read from a file. */
-      ret = read(*(p+1),*(p+2),*(p+3));
+
+    case SYS_CLOSE:
+      arg0 = get_arg (f, 0);
+      file = lookup_fd (arg0);
+      thread_current ()->fds[arg0] = NULL;
+      rwlock_acquire_write (&filesys_lock);
+      file_close (file);
+      rwlock_release_write (&filesys_lock);
       break;
-    case SYS_WRITE:                  /* Write to a file. */
-      ret = write(*(p+1),*(p+2),*(p+3));
+
+    case SYS_CLOCK:
+      arg0 = get_arg (f, 0);
+      check_writable ((void *) arg0, sizeof (int64_t));
+      *(int64_t *) arg0 = timer_now_ns ();
       break;
-    case SYS_SEEK:                   /* Change position in a file. */
-      ret = seek(*(p+1),*(p+2));
+
+    case SYS_FUTEX_WAIT:
+      arg0 = get_arg (f, 0);
+      arg1 = get_arg (f, 1);
+      check_futex ((int *) arg0);
+      f->eax = futex_wait ((int *) arg0, arg1);
       break;
-    case SYS_TELL:                   /* Report current position in a file. */
-      ret = tell(*(p+1));
+
+    case SYS_FUTEX_WAKE:
+      arg0 = get_arg (f, 0);
+      arg1 = get_arg (f, 1);
+      check_futex ((int *) arg0);
+      f->eax = futex_wake ((int *) arg0, arg1);
       break;
-    case SYS_CLOSE:                  /* Close a file. */
-      ret = close(*(p+1));
+
+#ifdef VM
+    case SYS_MMAP:
+      arg0 = get_arg (f, 0);
+      arg1 = get_arg (f, 1);
+      f->eax = sys_mmap (arg0, (void *) arg1);
       break;
-    }
 
-  f->eax = ret;
+    case SYS_MUNMAP:
+      sys_munmap (get_arg (f, 0));
+      break;
+#endif
 
+    default:
+      sys_exit (-1);
+    }
 }
 
-
-static int
-halt (void)
+/* Returns argument IDX of the system call whose frame is F.
+   Argument -1 is the system call number.  Terminates the process
+   if the argument is not in valid user memory. */
+static uint32_t
+get_arg (const struct intr_frame *f, int idx)
 {
-  shutdown_power_off();
+  const uint32_t *arg = (const uint32_t *) f->esp + idx + 1;
 
-  return 0;
+  check_user (arg, sizeof *arg);
+  return *arg;
 }
 
-
-static int
-exit (int status)
+/* Terminates the process unless all SIZE bytes starting at
+   UADDR are mapped user memory.  With virtual memory, pages of
+   the process that are not loaded yet are brought in, and the
+   stack is grown to cover UADDR if it is a stack address, so
+   that the kernel does not fault on them while holding locks. */
+static void
+check_user (const void *uaddr, size_t size)
 {
-  int ret = -1;
-  struct thread *t;
-  struct fdelem *fd
-  struct list_elem *l;
-      ;
-  t = thread_current ();
-  // close files of the thread
-  while (!list_empty (&t->files))
+  struct thread *cur = thread_current ();
+  uint32_t *pd = cur->pagedir;
+  const uint8_t *p = uaddr;
+  const uint8_t *end = p + size;
+
+  if (size == 0)
+    return;
+  if (end < p || !is_user_vaddr (end - 1))
+    sys_exit (-1);
+  for (p = pg_round_down (p); p < end; p += PGSIZE)
+    if (pagedir_get_page (pd, p) == NULL)
       {
-        l = list_begin (&t->files);
+#ifdef VM
+        const void *addr = p < (const uint8_t *) uaddr ? uaddr : p;
 
-        list_remove (&of_files->elem);
+        if (page_load (addr) || page_grow_stack (addr, cur->user_esp))
+          continue;
+#endif
+        sys_exit (-1);
       }
-
-  t->status = status;
-  thread_exit();
-
-  return ret;
 }
 
-
-static int
-exec(const char *file)
+/* Terminates the process unless all SIZE bytes starting at
+   UADDR are mapped user memory that the process may write.  The
+   kernel must check this before writing into a user buffer: it
+   runs with write protection enabled, so writing a read-only
+   user page would fault in the kernel and panic. */
+static void
+check_writable (void *uaddr, size_t size)
 {
-  int ret = -1;
-  ret = process_execute(file);
-  return ret;
-}
+  uint8_t *p;
 
-static int
-wait (int pid)
-{
-  return process_wait(pid);
+  if (size == 0)
+    return;
+  check_user (uaddr, size);
+  for (p = pg_round_down (uaddr); p < (uint8_t *) uaddr + size; p += PGSIZE)
+    {
+#ifdef VM
+      struct page *page = page_lookup (p);
+
+      if (page == NULL || !page->writable)
+        sys_exit (-1);
+#else
+      if (!pagedir_is_writable (thread_current ()->pagedir, p))
+        sys_exit (-1);
+#endif
+    }
 }
 
-/**
- * Creates a new file called file initially initial_size bytes in size.
- * Returns true if successful, false otherwise. Creating a new file does not
- * open it: opening the new file is a separate operation which would require
- * a open system call.
- */
-static int
-create (const char *file, unsigned initial_size)
+/* Writes SIZE bytes from user BUFFER to FILE if WRITE is true,
+   otherwise reads SIZE bytes from FILE into BUFFER, and returns
+   the number of bytes transferred.  The caller must have checked
+   BUFFER.  With virtual memory, each page of BUFFER is pinned
+   while the file system copies into or out of it, so that it
+   cannot be evicted and then fault with file system locks held.
+   Pinning one page at a time keeps a large buffer from pinning
+   every frame. */
+static off_t
+file_io (struct file *file, uint8_t *buffer, size_t size, bool write)
 {
-  return filesys_create(file, initial_size) ? 0 : -1;
-}
+#ifdef VM
+  off_t total = 0;
 
-/**
- * Deletes the file called file. Returns true if successful, false otherwise.
- * A file may be removed regardless of whether it is open or closed, and
- * removing an open file does not close it.
- */
-static int
-remove (const char *file)
-{
-  struct file *fd = filesys_open(file);
-  struct inode *fi = file_get_inode(fd);
-
-  // file will be deleted after last reader closes the file
-  inode_remove(fi);
-  return filesys_remove(file);
-}
-
-/**
- * Opens the file called file. Returns a nonnegative integer handle
- * called a "file descriptor" (fd), or -1 if the file could not be opened.
- */
-static int
-open (const char *file)
-{
-  struct file *fd = filesys_open(file);
-  if( fd == NULL )
+  while (size > 0)
     {
-      return -1;
-    }
-  else
-    {
-      struct fdelem fde;
-      fde.fd = get_next_fd();
-      fde.file = file;
-      struct thread t = thread_current();
-
-      // add current file to open files and thread files
-      list_push_back(&t.files, fde.thread_elem);
-      list_push_back(&open_files, fde.of_elem);
-      return fde.fd;
+      size_t chunk = PGSIZE - pg_ofs (buffer);
+      off_t n;
+
+      if (chunk > size)
+        chunk = size;
+      if (!page_pin (buffer))
+        sys_exit (-1);
+      n = locked_file_io (file, buffer, chunk, write);
+      page_unpin (buffer);
+
+      total += n;
+      if (n != (off_t) chunk)
+        break;
+      buffer += chunk;
+      size -= chunk;
     }
+  return total;
+#else
+  return locked_file_io (file, buffer, size, write);
+#endif
 }
 
-/**
- * @brief filesize
- * @param fd
- * @return the size, in bytes, of the file open as fd.
- */
-static int
-filesize (int fd)
+/* Does one file_write() or file_read() for file_io(), holding
+   the file system lock. */
+static off_t
+locked_file_io (struct file *file, void *buffer, size_t size, bool write)
 {
-  struct fdelem *fde = get_of_fd(fd);
+  off_t n;
 
-  if( fde == NULL )
+  if (write)
     {
-      return -1;
+      rwlock_acquire_write (&filesys_lock);
+      n = file_write (file, buffer, size);
+      rwlock_release_write (&filesys_lock);
     }
   else
     {
-      return file_length(fde->file);
+      rwlock_acquire_read (&filesys_lock);
+      n = file_read (file, buffer, size);
+      rwlock_release_read (&filesys_lock);
     }
+  return n;
 }
 
-/**
- * @brief read
- * the number of bytes actually read (0 at end of file),
- * or -1 if the file could not be read (due to a condition other than end
- * of file). Fd 0 reads from the keyboard using input_getc().
- * @param fd
- * @param buffer
- * @param length
- * @return
- */
-static int
-read (int fd, void *buffer, unsigned length)
+/* Terminates the process unless the null-terminated string
+   starting at S is entirely in mapped user memory. */
+static void
+check_string (const char *s)
 {
-
-  if (fd == 0)
-      {
-        // TODO
-      }
-    else if (fd == 1)
+  for (;;)
     {
-      return -1;
+      check_user (s, 1);
+      if (*s++ == '\0')
+        break;
     }
-  else
-    {
-      struct fdelem *fde = get_of_fd(fd);
+}
 
-      if( fde == NULL )
-        {
-          return -1;
-        }
-      else
-        {
-          return file_read(fde->file,buffer,length);
-        }
-    }
+/* Terminates the process unless UADDR is a properly aligned
+   futex in mapped user memory. */
+static void
+check_futex (int *uaddr)
+{
+  if ((uintptr_t) uaddr % sizeof *uaddr != 0)
+    sys_exit (-1);
+  check_user (uaddr, sizeof *uaddr);
+}
+
+/* Terminates the current process with the given exit STATUS. */
+static void
+sys_exit (int status)
+{
+  printf ("%s: exit(%d)\n", thread_name (), status);
+  thread_exit ();
 }
 
+/* Adds FILE to the current process's file descriptor table in
+   the lowest free slot, growing the table if it is full, and
+   returns the new file descriptor.  Returns -1 if memory
+   allocation fails. */
 static int
-write (int fd, const void *buffer, unsigned length)
+alloc_fd (struct file *file)
 {
+  struct thread *cur = thread_current ();
+  int fd;
 
-  if( fd == 0 )
-    {
-      return -1;
-    }
-  else
+  for (fd = FIRST_FILE_FD; fd < cur->fd_cnt; fd++)
+    if (cur->fds[fd] == NULL)
+      break;
+
+  if (fd >= cur->fd_cnt)
     {
-     struct fdelem *fde = get_of_fd(fd);
-
-     if( fde == NULL )
-       {
-         return -1;
-       }
-     else
-       {
-         return file_write(fde->file, buffer, length);
-       }
+      int new_cnt = cur->fd_cnt > 0 ? cur->fd_cnt * 2 : INITIAL_FD_CNT;
+      struct file **fds = realloc (cur->fds, new_cnt * sizeof *fds);
+      int i;
+
+      if (fds == NULL)
+        return -1;
+      for (i = cur->fd_cnt; i < new_cnt; i++)
+        fds[i] = NULL;
+      cur->fds = fds;
+      cur->fd_cnt = new_cnt;
     }
+
+  cur->fds[fd] = file;
+  return fd;
 }
 
-/**
- * @brief seek These semantics are implemented in the file system and do not
- * require any special effort in system call implementation.
- * @param fd
- * @param position
- * @return
- */
-static int
-seek (int fd, unsigned position)
+/* Returns the file that the current process has open as FD.
+   Terminates the process if FD is not open. */
+static struct file *
+lookup_fd (int fd)
 {
-  if( fd == 0 )
-    {
-      return -1;
-    }
-  else
-    {
-     struct fdelem *fde = get_of_fd(fd);
-
-     if( fde == NULL )
-       {
-         return -1;
-       }
-     else
-       {
-         file_seek(fde->file, position);
-         return 0;
-       }
-    }
+  struct thread *cur = thread_current ();
+
+  if (fd < FIRST_FILE_FD || fd >= cur->fd_cnt || cur->fds[fd] == NULL)
+    sys_exit (-1);
+  return cur->fds[fd];
 }
 
-/**
- * @brief tell
- * @param fd
- * @return the position of the next byte to be read or written in open file fd,
- * expressed in bytes from the beginning of the file.
- */
+#ifdef VM
+/* Maps the file open as FD into the current process's memory
+   starting at ADDR, which must be page-aligned, and returns a
+   new mapping identifier.  Pages are read from the file when
+   first touched, and modified pages are written back when they
+   are evicted or unmapped.  Returns -1 if FD is not an open file
+   or is empty, or if the mapping would not fit in free user
+   memory starting at ADDR. */
 static int
-tell (int fd)
+sys_mmap (int fd, void *addr)
 {
-  if( fd == 0 )
+  struct thread *cur = thread_current ();
+  struct mapping *m;
+  off_t length = 0;
+  size_t i;
+  int mapid;
+
+  if (fd < FIRST_FILE_FD || fd >= cur->fd_cnt || cur->fds[fd] == NULL
+      || addr == NULL || pg_ofs (addr) != 0 || !is_user_vaddr (addr))
+    return -1;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return -1;
+  rwlock_acquire_read (&filesys_lock);
+  m->file = file_reopen (cur->fds[fd]);
+  if (m->file != NULL)
+    length = file_length (m->file);
+  rwlock_release_read (&filesys_lock);
+  m->base = addr;
+  m->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+
+  /* Add the pages, unless they would run into kernel memory. */
+  if (length == 0
+      || m->page_cnt > (size_t) ((uint8_t *) PHYS_BASE - m->base) / PGSIZE)
+    m->page_cnt = 0;
+  for (i = 0; i < m->page_cnt; i++)
     {
-      return -1;
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (!page_add_mmap (m->base + ofs, m->file, ofs, read_bytes))
+        break;
     }
-  else
+
+  mapid = m->page_cnt > 0 && i == m->page_cnt ? alloc_mapid (m) : -1;
+  if (mapid < 0)
     {
-     struct fdelem *fde = get_of_fd(fd);
-
-     if( fde == NULL )
-       {
-         return -1;
-       }
-     else
-       {
-         return file_tell(fde->file);
-       }
+      /* Undo the pages added so far. */
+      m->page_cnt = i;
+      unmap (m);
     }
+  return mapid;
 }
 
-/**
- * @brief close
- * @param fd
- * @return
- */
+/* Adds M to the current process's mapping table in the lowest
+   free slot, growing the table if it is full, and returns the
+   new mapping identifier.  Returns -1 if memory allocation
+   fails. */
 static int
-close (int fd)
+alloc_mapid (struct mapping *m)
 {
-  int ret = -1;
-  struct fdelem *fd;
+  struct thread *cur = thread_current ();
+  int mapid;
 
-  list_remove (&fd->elem);
-  list_remove (&fd->thread_elem);
-
-  return ret;
-}
+  for (mapid = 0; mapid < cur->mapping_cnt; mapid++)
+    if (cur->mappings[mapid] == NULL)
+      break;
 
+  if (mapid >= cur->mapping_cnt)
+    {
+      int new_cnt = (cur->mapping_cnt > 0 ? cur->mapping_cnt * 2
+                     : INITIAL_MAPPING_CNT);
+      struct mapping **mappings
+        = realloc (cur->mappings, new_cnt * sizeof *mappings);
+      int i;
+
+      if (mappings == NULL)
+        return -1;
+      for (i = cur->mapping_cnt; i < new_cnt; i++)
+        mappings[i] = NULL;
+      cur->mappings = mappings;
+      cur->mapping_cnt = new_cnt;
+    }
 
-/**
- * @brief get_next_fd
- * @return next available file descriptor
- */
-static int
-get_next_fd()
-{
-  return next_fd++;
+  cur->mappings[mapid] = m;
+  return mapid;
 }
 
-
-/**
- * @brief get_of_fd
- * @param fd
- * @return struct fdelem
- */
-static struct fdelem*
-get_of_fd (int fd)
+/* Removes the current process's mapping MAPID.  Terminates the
+   process if there is no such mapping. */
+static void
+sys_munmap (int mapid)
 {
-  struct list_elem *e;
-
-  for (e = list_begin (&open_files); e != list_end (&open_files);
-       e = list_next (e))
-    {
-      struct fdelem *fde = list_entry (e, struct fdelem, of_elem);
-      if( fde->fd == fd )
-        {
-          return fde;
-        }
-    }
+  struct thread *cur = thread_current ();
 
-  return NULL;
+  if (mapid < 0 || mapid >= cur->mapping_cnt
+      || cur->mappings[mapid] == NULL)
+    sys_exit (-1);
+  unmap (cur->mappings[mapid]);
+  cur->mappings[mapid] = NULL;
 }
 
-
-/**
- * @brief get_tf_fd
- * @param fd
- * @return struct fdelem
- */
-static struct fdelem*
-get_tf_fd (int fd)
+/* Removes the pages of mapping M from the current process,
+   writing back the ones that were modified, then closes its file
+   and frees M. */
+static void
+unmap (struct mapping *m)
 {
-  struct list_elem *e;
+  size_t i;
 
-  for (e = list_begin (&t->files); e != list_end (&t->files);
-       e = list_next (e))
-    {
-      struct fdelem *fde = list_entry (e, struct fdelem, thread_elem);
-      if( fde->fd == fd )
-        {
-          return fde;
-        }
-    }
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (m->base + i * PGSIZE);
 
-  return NULL;
+  rwlock_acquire_write (&filesys_lock);
+  file_close (m->file);
+  rwlock_release_write (&filesys_lock);
+  free (m);
 }
+#endif
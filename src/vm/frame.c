@@ -0,0 +1,415 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Most frames evicted at once.  When the frame chosen for
+   eviction must be written to swap, the frames that follow it
+   that have not been used recently are evicted along with it, so
+   that they all go to swap in a single run of writes. */
+#define SWAP_CLUSTER 8
+
+/* Every frame in the user pool. */
+static struct frame *frames;
+static size_t frame_cnt;
+
+/* Protects the clock hand.  Must be acquired before any frame's
+   lock, never after. */
+static struct lock scan_lock;
+static struct lock_stats scan_lock_stats;
+
+/* Next frame to be considered for eviction. */
+static size_t hand;
+
+/* Frames shared among processes, keyed by their contents.
+   share_lock must be acquired after any frame's lock, never
+   before. */
+static struct hash shared_frames;
+static struct lock share_lock;
+
+static struct frame *try_frame_alloc_and_lock (struct page *);
+static struct page *frame_first_page (struct frame *);
+static bool frame_accessed_recently (struct frame *);
+static bool frame_unmap (struct frame *);
+static void frame_evicted (struct frame *, size_t swap_slot);
+static void frame_unshare (struct frame *);
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
+/* Initializes the frame table by taking every page in the user
+   pool. */
+void
+frame_init (void)
+{
+  void *free_list = NULL;
+  void *kpage;
+  size_t i;
+
+  /* Each page links to the next until the table exists. */
+  while ((kpage = palloc_get_page (PAL_USER)) != NULL)
+    {
+      *(void **) kpage = free_list;
+      free_list = kpage;
+      frame_cnt++;
+    }
+
+  frames = malloc (frame_cnt * sizeof *frames);
+  if (frames == NULL && frame_cnt > 0)
+    PANIC ("out of memory allocating frame table");
+  for (i = 0; i < frame_cnt; i++)
+    {
+      struct frame *f = &frames[i];
+
+      f->kpage = free_list;
+      free_list = *(void **) free_list;
+      lock_init (&f->lock);
+      list_init (&f->pages);
+      f->pin_cnt = 0;
+      f->inode = NULL;
+    }
+
+  lock_init (&scan_lock);
+  lock_stats_init (&scan_lock_stats, "frame table");
+  lock_set_stats (&scan_lock, &scan_lock_stats);
+  hand = 0;
+
+  if (!hash_init (&shared_frames, share_hash, share_less, NULL))
+    PANIC ("out of memory allocating shared frame table");
+  lock_init (&share_lock);
+}
+
+/* Returns a frame for PAGE with its lock held, evicting another
+   frame if none is free.  PAGE is the frame's only page.  Returns
+   a null pointer if every frame stays locked by other threads or
+   pinned. */
+struct frame *
+frame_alloc_and_lock (struct page *page)
+{
+  int try;
+
+  for (try = 0; try < 3; try++)
+    {
+      struct frame *f = try_frame_alloc_and_lock (page);
+      if (f != NULL)
+        return f;
+
+      /* Every frame is busy.  Let their holders finish. */
+      thread_yield ();
+    }
+  return NULL;
+}
+
+/* Acquires F's lock, which keeps its page from being evicted
+   until frame_unlock(). */
+void
+frame_lock (struct frame *f)
+{
+  lock_acquire (&f->lock);
+}
+
+/* Releases F's lock. */
+void
+frame_unlock (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  lock_release (&f->lock);
+}
+
+/* Adds PAGE to the pages mapped to F, which must be locked. */
+void
+frame_add_page (struct frame *f, struct page *page)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  list_push_back (&f->pages, &page->frame_elem);
+}
+
+/* Removes PAGE, which must already be unmapped, from the pages
+   mapped to F, frees F if that was the last of them, and
+   releases F's lock. */
+void
+frame_release_page (struct frame *f, struct page *page)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  list_remove (&page->frame_elem);
+  if (list_empty (&f->pages))
+    {
+      ASSERT (f->pin_cnt == 0);
+      frame_unshare (f);
+    }
+  lock_release (&f->lock);
+}
+
+/* Offers F, which must be locked and must not be shared yet, to
+   other processes as the frame that holds READ_BYTES bytes of
+   INODE starting at OFS, followed by zeros, as a writable page
+   of a mapped file if WRITE_BACK is true or a read-only page
+   otherwise.  The caller must fill in F before unlocking it.
+   Returns false, leaving F private, if another frame already
+   holds those contents. */
+bool
+frame_share (struct frame *f, struct inode *inode, off_t ofs,
+             size_t read_bytes, bool write_back)
+{
+  bool success;
+
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (f->inode == NULL);
+
+  f->inode = inode;
+  f->ofs = ofs;
+  f->read_bytes = read_bytes;
+  f->write_back = write_back;
+
+  lock_acquire (&share_lock);
+  success = hash_insert (&shared_frames, &f->share_elem) == NULL;
+  lock_release (&share_lock);
+
+  if (!success)
+    f->inode = NULL;
+  return success;
+}
+
+/* Returns the shared frame that holds READ_BYTES bytes of INODE
+   starting at OFS, writable if WRITE_BACK is true, with its lock
+   held, or a null pointer if there is none.  Waits for a frame
+   that is still being filled or evicted. */
+struct frame *
+frame_lock_shared (struct inode *inode, off_t ofs, size_t read_bytes,
+                   bool write_back)
+{
+  struct frame key;
+  struct hash_elem *e;
+  struct frame *f;
+
+  key.inode = inode;
+  key.ofs = ofs;
+  key.read_bytes = read_bytes;
+  key.write_back = write_back;
+
+  lock_acquire (&share_lock);
+  e = hash_find (&shared_frames, &key.share_elem);
+  f = e != NULL ? hash_entry (e, struct frame, share_elem) : NULL;
+  lock_release (&share_lock);
+  if (f == NULL)
+    return NULL;
+
+  /* F may change while we wait for it, so check that it still
+     holds the same contents.  Only its lock is needed for that:
+     the contents only change with the lock held. */
+  lock_acquire (&f->lock);
+  if (f->inode != inode || f->ofs != ofs || f->read_bytes != read_bytes
+      || f->write_back != write_back)
+    {
+      lock_release (&f->lock);
+      return NULL;
+    }
+  return f;
+}
+
+/* Tries once around the clock for a frame for PAGE, as described
+   in frame_alloc_and_lock(). */
+static struct frame *
+try_frame_alloc_and_lock (struct page *page)
+{
+  struct frame *victims[SWAP_CLUSTER];
+  void *kpages[SWAP_CLUSTER];
+  size_t slots[SWAP_CLUSTER];
+  bool dirty[SWAP_CLUSTER];
+  size_t victim_cnt = 0;
+  size_t dirty_cnt = 0;
+  bool cluster;
+  size_t i, j;
+
+  lock_acquire (&scan_lock);
+
+  /* Find a free frame or a victim with the second-chance clock
+     algorithm.  Two trips around clear every accessed bit, so
+     only frames that stay locked or pinned can keep us from
+     finding one. */
+  for (i = 0; i < 2 * frame_cnt; i++)
+    {
+      struct frame *f = &frames[hand];
+      hand = (hand + 1) % frame_cnt;
+
+      if (lock_held_by_current_thread (&f->lock)
+          || !lock_try_acquire (&f->lock))
+        continue;
+      if (list_empty (&f->pages))
+        {
+          frame_add_page (f, page);
+          lock_release (&scan_lock);
+          return f;
+        }
+      if (f->pin_cnt > 0 || frame_accessed_recently (f))
+        {
+          lock_release (&f->lock);
+          continue;
+        }
+
+      victims[victim_cnt] = f;
+      dirty[victim_cnt] = frame_unmap (f);
+      victim_cnt++;
+      break;
+    }
+  if (victim_cnt == 0)
+    {
+      lock_release (&scan_lock);
+      return NULL;
+    }
+
+  /* If the victim must go to swap, take the frames after it
+     that have not been used recently along with it. */
+  cluster = dirty[0] && !frame_first_page (victims[0])->write_back;
+  for (i = 0; cluster && i < SWAP_CLUSTER - 1; i++)
+    {
+      struct frame *f = &frames[hand];
+      hand = (hand + 1) % frame_cnt;
+
+      if (lock_held_by_current_thread (&f->lock)
+          || !lock_try_acquire (&f->lock))
+        continue;
+      if (list_empty (&f->pages) || f->pin_cnt > 0
+          || frame_accessed_recently (f))
+        {
+          lock_release (&f->lock);
+          continue;
+        }
+
+      victims[victim_cnt] = f;
+      dirty[victim_cnt] = frame_unmap (f);
+      victim_cnt++;
+    }
+  lock_release (&scan_lock);
+
+  /* Write out the dirty pages: pages of mapped files to their
+     files, the others to swap together.  The rest can be read
+     back from where they came from. */
+  for (i = 0; i < victim_cnt; i++)
+    if (dirty[i])
+      {
+        struct page *p = frame_first_page (victims[i]);
+
+        if (p->write_back)
+          {
+            page_write_back (p);
+            dirty[i] = false;
+          }
+        else
+          kpages[dirty_cnt++] = victims[i]->kpage;
+      }
+  swap_out (kpages, slots, dirty_cnt);
+
+  for (i = j = 0; i < victim_cnt; i++)
+    frame_evicted (victims[i], dirty[i] ? slots[j++] : SWAP_NONE);
+
+  /* Keep the first victim for PAGE and free the others. */
+  for (i = 1; i < victim_cnt; i++)
+    lock_release (&victims[i]->lock);
+  frame_add_page (victims[0], page);
+  return victims[0];
+}
+
+/* Returns the first page mapped to F. */
+static struct page *
+frame_first_page (struct frame *f)
+{
+  return list_entry (list_front (&f->pages), struct page, frame_elem);
+}
+
+/* Returns true if any page mapped to F has been accessed since
+   the last call, and clears all of their accessed bits.  F must
+   be locked. */
+static bool
+frame_accessed_recently (struct frame *f)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    if (page_accessed_recently (list_entry (e, struct page, frame_elem)))
+      accessed = true;
+  return accessed;
+}
+
+/* Unmaps every page mapped to F, which must be locked, in
+   preparation for evicting it.  Returns true if F was modified
+   through any of its pages and so must be written back.  A
+   frame with more than one page can only be modified if it
+   holds a page of a mapped file, which is written back to the
+   file rather than to swap. */
+static bool
+frame_unmap (struct frame *f)
+{
+  struct list_elem *e;
+  bool dirty = false;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    if (page_unmap (list_entry (e, struct page, frame_elem)))
+      dirty = true;
+  ASSERT (!dirty || list_size (&f->pages) == 1
+          || frame_first_page (f)->write_back);
+  return dirty;
+}
+
+/* Records that the pages mapped to F, which must be locked and
+   unmapped, are no longer in memory, and that F's contents are
+   in SWAP_SLOT, or in their original backing store if SWAP_SLOT
+   is SWAP_NONE.  F is left free. */
+static void
+frame_evicted (struct frame *f, size_t swap_slot)
+{
+  while (!list_empty (&f->pages))
+    page_evicted (list_entry (list_pop_front (&f->pages),
+                              struct page, frame_elem), swap_slot);
+  frame_unshare (f);
+}
+
+/* Withdraws F, which must be locked, from sharing, if it is
+   shared. */
+static void
+frame_unshare (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  if (f->inode != NULL)
+    {
+      lock_acquire (&share_lock);
+      hash_delete (&shared_frames, &f->share_elem);
+      lock_release (&share_lock);
+      f->inode = NULL;
+    }
+}
+
+/* Returns a hash value for shared frame E. */
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, share_elem);
+  return (hash_bytes (&f->inode, sizeof f->inode)
+          ^ hash_int (f->ofs) ^ hash_int (f->read_bytes));
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, share_elem);
+  const struct frame *b = hash_entry (b_, struct frame, share_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  else if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  else if (a->read_bytes != b->read_bytes)
+    return a->read_bytes < b->read_bytes;
+  else
+    return a->write_back < b->write_back;
+}
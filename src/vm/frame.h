@@ -0,0 +1,53 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct inode;
+struct page;
+
+/* A physical frame in the user pool.
+
+   A frame is usually mapped by a single page.  A frame that
+   holds a read-only page of an executable may be mapped by one
+   page in each process running the executable, and a frame
+   that holds a page of a memory-mapped file by one page in each
+   process that maps the file.  A shared frame is freed when the
+   last of its pages is removed. */
+struct frame
+  {
+    struct lock lock;           /* Held while the frame is being filled,
+                                   evicted, or its pages change. */
+    void *kpage;                /* Kernel virtual address. */
+    struct list pages;          /* Pages mapped to the frame, by their
+                                   frame_elem.  Empty if free. */
+    int pin_cnt;                /* Number of page_pin() calls keeping
+                                   the frame from being evicted. */
+
+    /* Identifies the contents of a shared frame: READ_BYTES bytes
+       of INODE starting at OFS, either read-only or, for mapped
+       files, writable and written back to INODE.  INODE is null
+       if the frame is not shared. */
+    struct hash_elem share_elem; /* Element in shared frame table. */
+    struct inode *inode;        /* Inode, or a null pointer. */
+    off_t ofs;                  /* Offset in INODE. */
+    size_t read_bytes;          /* Bytes of INODE in the frame. */
+    bool write_back;            /* Writable mapping of INODE? */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc_and_lock (struct page *);
+void frame_lock (struct frame *);
+void frame_unlock (struct frame *);
+void frame_add_page (struct frame *, struct page *);
+void frame_release_page (struct frame *, struct page *);
+
+bool frame_share (struct frame *, struct inode *, off_t ofs,
+                  size_t read_bytes, bool write_back);
+struct frame *frame_lock_shared (struct inode *, off_t ofs,
+                                 size_t read_bytes, bool write_back);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,503 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Pages below the stack pointer that a process may touch: PUSHA
+   writes 32 bytes below it before moving it. */
+#define STACK_SLOP 32
+
+/* Maximum number of pages in a user stack.  The default is
+   8 MB. */
+size_t stack_page_limit = 2048;
+
+static struct page *page_add (void *upage, bool writable);
+static struct frame *lock_page_frame (struct page *);
+static bool shareable (const struct page *);
+static bool share_frame (struct page *);
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+
+/* Initializes the current thread's supplemental page table.
+   Returns true if successful, false if memory allocation
+   fails. */
+bool
+page_table_init (void)
+{
+  return hash_init (&thread_current ()->pages, page_hash, page_less, NULL);
+}
+
+/* Destroys the current thread's supplemental page table,
+   unmapping and freeing every page that is in memory and every
+   swap slot that holds one. */
+void
+page_table_destroy (void)
+{
+  hash_destroy (&thread_current ()->pages, page_destroy);
+}
+
+/* Adds a page at user virtual address UPAGE to the current
+   process, whose first READ_BYTES bytes are read from FILE
+   starting at offset OFS and whose remaining bytes are zeros.
+   The page is writable by the process if WRITABLE is true.
+   FILE must remain open as long as the page exists.  Returns
+   true if successful, false if UPAGE is already in use or
+   memory allocation fails. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (file != NULL);
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = page_add (upage, writable);
+  if (p == NULL)
+    return false;
+  p->file = file;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  return true;
+}
+
+/* Adds a page at user virtual address UPAGE to the current
+   process that starts out all zeros.  The page is writable by
+   the process if WRITABLE is true.  Returns true if successful,
+   false if UPAGE is already in use or memory allocation
+   fails. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  return page_add (upage, writable) != NULL;
+}
+
+/* Adds a page at user virtual address UPAGE to the current
+   process that maps READ_BYTES bytes of FILE starting at offset
+   OFS, followed by zeros.  The page is writable, and changes to
+   it are written back to FILE when it is evicted or removed.
+   FILE must remain open as long as the page exists.  Returns
+   true if successful, false if UPAGE is already in use or memory
+   allocation fails. */
+bool
+page_add_mmap (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes)
+{
+  struct page *p;
+
+  ASSERT (file != NULL);
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = page_add (upage, true);
+  if (p == NULL)
+    return false;
+  p->file = file;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->write_back = true;
+  return true;
+}
+
+/* Removes the current process's page at UPAGE, which must exist,
+   writing it back to its file first if it is a modified page of
+   a mapped file. */
+void
+page_remove (void *upage)
+{
+  struct page *p = page_lookup (upage);
+
+  ASSERT (p != NULL);
+
+  hash_delete (&thread_current ()->pages, &p->elem);
+  page_destroy (&p->elem, NULL);
+}
+
+/* Returns the current process's page that contains user virtual
+   address UADDR, or a null pointer if there is none. */
+struct page *
+page_lookup (const void *uaddr)
+{
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = pg_round_down (uaddr);
+  e = hash_find (&thread_current ()->pages, &p.elem);
+  return e != NULL ? hash_entry (e, struct page, elem) : NULL;
+}
+
+/* Brings the current process's page that contains user virtual
+   address UADDR into memory and maps it, if it is not mapped
+   already.  Returns true if successful, false if UADDR is not in
+   any page of the process or if the page cannot be loaded. */
+bool
+page_load (const void *uaddr)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+  struct frame *f;
+  uint8_t *kpage;
+  bool from_swap;
+
+  if (t->pagedir == NULL || !is_user_vaddr (uaddr))
+    return false;
+  p = page_lookup (uaddr);
+  if (p == NULL)
+    return false;
+
+  /* Already in memory. */
+  f = lock_page_frame (p);
+  if (f != NULL)
+    {
+      frame_unlock (f);
+      return true;
+    }
+
+  /* Use another process's copy, if there is one. */
+  if (shareable (p) && share_frame (p))
+    return true;
+
+  f = frame_alloc_and_lock (p);
+  if (f == NULL)
+    return false;
+  kpage = f->kpage;
+
+  /* Let other processes find the page while we read it, so that
+     they wait for this read instead of starting their own. */
+  if (shareable (p))
+    frame_share (f, file_get_inode (p->file), p->file_ofs, p->read_bytes,
+                 p->write_back);
+
+  /* Fill in the page. */
+  from_swap = p->swap_slot != SWAP_NONE;
+  if (from_swap)
+    {
+      swap_in (p->swap_slot, kpage);
+      p->swap_slot = SWAP_NONE;
+    }
+  else
+    {
+      if (p->file != NULL && p->read_bytes > 0
+          && file_read_at (p->file, kpage, p->read_bytes, p->file_ofs)
+             != (off_t) p->read_bytes)
+        {
+          frame_release_page (f, p);
+          return false;
+        }
+      memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+    }
+
+  if (!pagedir_set_page (t->pagedir, p->upage, kpage, p->writable))
+    {
+      frame_release_page (f, p);
+      return false;
+    }
+
+  /* The copy in swap is gone, so the page must go back there
+     when it is evicted even if it is not written again. */
+  if (from_swap)
+    pagedir_set_dirty (t->pagedir, p->upage, true);
+
+  p->frame = f;
+  frame_unlock (f);
+  return true;
+}
+
+/* Brings the current process's page that contains user virtual
+   address UADDR into memory, as page_load() does, and pins it
+   there: the frame table does not evict it until page_unpin().
+   The kernel pins user buffers that it passes to the file
+   system, which must not fault on them while it holds its locks.
+   Returns false if page_load() fails. */
+bool
+page_pin (const void *uaddr)
+{
+  struct frame *f;
+
+  /* The page can be evicted again between page_load() and
+     locking its frame.  Then load it again. */
+  do
+    {
+      if (!page_load (uaddr))
+        return false;
+      f = lock_page_frame (page_lookup (uaddr));
+    }
+  while (f == NULL);
+
+  f->pin_cnt++;
+  frame_unlock (f);
+  return true;
+}
+
+/* Releases a pin taken on the page that contains UADDR by
+   page_pin(). */
+void
+page_unpin (const void *uaddr)
+{
+  struct page *p = page_lookup (uaddr);
+  struct frame *f;
+
+  ASSERT (p != NULL && p->frame != NULL);
+
+  /* A pinned page stays in its frame, so P->frame is stable. */
+  f = p->frame;
+  frame_lock (f);
+  ASSERT (f->pin_cnt > 0);
+  f->pin_cnt--;
+  frame_unlock (f);
+}
+
+/* If user virtual address UADDR is in a page of a file that the
+   current process has mapped, and which other processes that map
+   the file therefore share, stores the file's inode in *INODE
+   and the offset of UADDR within the file in *OFS and returns
+   true.  Otherwise, returns false. */
+bool
+page_mapped_file (const void *uaddr, struct inode **inode, off_t *ofs)
+{
+  struct page *p = page_lookup (uaddr);
+
+  if (p == NULL || !p->write_back)
+    return false;
+  *inode = file_get_inode (p->file);
+  *ofs = p->file_ofs + pg_ofs (uaddr);
+  return true;
+}
+
+/* Extends the current process's stack down to the page that
+   contains UADDR, given that its user stack pointer is ESP, if
+   UADDR looks like a stack access: at most STACK_SLOP bytes below
+   ESP and within stack_page_limit pages of the top of user
+   memory.  Only the page containing UADDR is added; pages
+   skipped over are added when they are touched in turn.  Returns
+   true if successful, false if UADDR is not a stack access or
+   the page cannot be added and loaded. */
+bool
+page_grow_stack (const void *uaddr, const void *esp)
+{
+  const uint8_t *addr = uaddr;
+  uint8_t *upage = pg_round_down (uaddr);
+
+  if (thread_current ()->pagedir == NULL || !is_user_vaddr (uaddr)
+      || addr + STACK_SLOP < (const uint8_t *) esp
+      || (size_t) ((uint8_t *) PHYS_BASE - upage) / PGSIZE > stack_page_limit)
+    return false;
+
+  /* Stack pages start out zeroed and go to swap when evicted,
+     like any other anonymous page. */
+  return page_add_zero (upage, true) && page_load (upage);
+}
+
+/* Returns true if P has been accessed since the last call, and
+   clears its accessed bit.  P's frame must be locked. */
+bool
+page_accessed_recently (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+  bool accessed;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  accessed = pagedir_is_accessed (pd, p->upage);
+  if (accessed)
+    pagedir_set_accessed (pd, p->upage, false);
+  return accessed;
+}
+
+/* Removes P from its owner's page directory in preparation for
+   evicting it, so that the owner faults if it touches P again.
+   Returns true if P was modified while it was mapped and so must
+   be written to swap.  P's frame must be locked. */
+bool
+page_unmap (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Clearing the mapping first means that the dirty bit cannot
+     change after we read it. */
+  pagedir_clear_page (pd, p->upage);
+  return pagedir_is_dirty (pd, p->upage);
+}
+
+/* Writes the first read_bytes bytes of P, a page of a mapped
+   file, back to the file.  P's frame must be locked.  The file
+   system has its own locks for writes that do not extend a file,
+   so the file system lock is not needed, which lets threads
+   evict pages while holding it. */
+void
+page_write_back (struct page *p)
+{
+  ASSERT (p->write_back);
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  file_write_at (p->file, p->frame->kpage, p->read_bytes, p->file_ofs);
+}
+
+/* Records that P, which was unmapped by page_unmap(), is no
+   longer in memory, and that its contents are in SWAP_SLOT, or
+   in its original backing store if SWAP_SLOT is SWAP_NONE.  P's
+   frame must be locked. */
+void
+page_evicted (struct page *p, size_t swap_slot)
+{
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  p->swap_slot = swap_slot;
+
+  /* The owner checks frame without the lock, so it must not see
+     the page leave memory before the swap slot is recorded. */
+  barrier ();
+  p->frame = NULL;
+}
+
+/* Adds an unloaded page at UPAGE to the current process's
+   supplemental page table and returns it, with no backing file.
+   Returns a null pointer if UPAGE is already in use or memory
+   allocation fails. */
+static struct page *
+page_add (void *upage, bool writable)
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->writable = writable;
+  p->thread = thread_current ();
+  p->frame = NULL;
+  p->swap_slot = SWAP_NONE;
+  p->file = NULL;
+  p->file_ofs = 0;
+  p->read_bytes = 0;
+  p->write_back = false;
+
+  if (hash_insert (&thread_current ()->pages, &p->elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* If P is in memory, locks and returns the frame that holds it,
+   which keeps it there until the frame is unlocked.  Otherwise,
+   returns a null pointer.  Only P's owner may call this, because
+   only the owner brings P back into memory after it has been
+   evicted. */
+static struct frame *
+lock_page_frame (struct page *p)
+{
+  struct frame *f = p->frame;
+
+  ASSERT (p->thread == thread_current ());
+
+  if (f != NULL)
+    {
+      /* Wait out an eviction in progress. */
+      frame_lock (f);
+      if (f != p->frame)
+        {
+          frame_unlock (f);
+          f = NULL;
+        }
+    }
+  return f;
+}
+
+/* Returns true if P may share a frame with other processes: a
+   read-only page of an executable, or a page of a mapped file,
+   whose changes every process that maps the file sees and that
+   are written back to the file.  Mappings of the same file page
+   with different READ_BYTES, because the file's length changed
+   between them, do not share a frame. */
+static bool
+shareable (const struct page *p)
+{
+  return p->file != NULL && (p->write_back || !p->writable);
+}
+
+
+/* Maps P, which must be shareable, to a frame that already holds
+   its contents for another process, if there is one.  Returns
+   true if successful, false if there is none or if memory
+   allocation fails. */
+static bool
+share_frame (struct page *p)
+{
+  struct frame *f = frame_lock_shared (file_get_inode (p->file),
+                                       p->file_ofs, p->read_bytes,
+                                       p->write_back);
+
+  if (f == NULL)
+    return false;
+  if (!pagedir_set_page (p->thread->pagedir, p->upage, f->kpage,
+                         p->writable))
+    {
+      frame_unlock (f);
+      return false;
+    }
+  frame_add_page (f, p);
+  p->frame = f;
+  frame_unlock (f);
+  return true;
+}
+
+/* Returns a hash value for page E. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, elem);
+  const struct page *b = hash_entry (b_, struct page, elem);
+
+  return a->upage < b->upage;
+}
+
+/* Unmaps and frees page E of the current process, along with
+   its swap slot or its frame, unless other processes share the
+   frame.  A modified page of a mapped file is written back
+   first. */
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, elem);
+  struct frame *f = lock_page_frame (p);
+
+  if (f != NULL)
+    {
+      uint32_t *pd = p->thread->pagedir;
+
+      pagedir_clear_page (pd, p->upage);
+      if (p->write_back && pagedir_is_dirty (pd, p->upage))
+        page_write_back (p);
+      frame_release_page (f, p);
+    }
+  else if (p->swap_slot != SWAP_NONE)
+    swap_free (p->swap_slot);
+  free (p);
+}
@@ -0,0 +1,72 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct inode;
+
+/* A page of a user process's virtual memory.
+
+   Each process has a supplemental page table, keyed by user
+   virtual address, that describes every page it may access.  A
+   page is not given a frame until the process first touches it,
+   at which point page_load() fills it in from its backing store
+   and maps it in the process's page directory.  When memory runs
+   short, the frame table evicts the page again, writing it to
+   swap if it was modified.
+
+   Only the owning thread brings a page into memory, but any
+   thread may evict it while holding its frame's lock.  Read-only
+   pages of an executable share a frame with the same pages of
+   other processes running it, and pages of a mapped file with
+   the same pages mapped by other processes. */
+struct page
+  {
+    struct hash_elem elem;      /* Element in thread's page table. */
+    void *upage;                /* User virtual address. */
+    bool writable;              /* Writable by the process? */
+    struct thread *thread;      /* Owning thread. */
+    struct frame *frame;        /* Frame holding the page, or a null
+                                   pointer if not in memory. */
+    struct list_elem frame_elem; /* Element in frame's pages list. */
+    size_t swap_slot;           /* Swap slot holding the page, or
+                                   SWAP_NONE. */
+
+    /* Contents when not in memory or swap: READ_BYTES bytes read
+       from FILE starting at FILE_OFS, followed by zeros.  If FILE
+       is null, the page is all zeros. */
+    struct file *file;          /* File to read, or a null pointer. */
+    off_t file_ofs;             /* Offset in FILE. */
+    size_t read_bytes;          /* Bytes to read, at most PGSIZE. */
+    bool write_back;            /* Write changes back to FILE instead
+                                   of to swap? */
+  };
+
+/* Maximum number of pages in a user stack. */
+extern size_t stack_page_limit;
+
+bool page_table_init (void);
+void page_table_destroy (void);
+
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+bool page_add_mmap (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes);
+void page_remove (void *upage);
+struct page *page_lookup (const void *uaddr);
+bool page_load (const void *uaddr);
+bool page_pin (const void *uaddr);
+void page_unpin (const void *uaddr);
+bool page_mapped_file (const void *uaddr, struct inode **, off_t *ofs);
+bool page_grow_stack (const void *uaddr, const void *esp);
+
+bool page_accessed_recently (struct page *);
+bool page_unmap (struct page *);
+void page_write_back (struct page *);
+void page_evicted (struct page *, size_t swap_slot);
+
+#endif /* vm/page.h */
@@ -0,0 +1,95 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Number of sectors in a swap slot. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The swap device, or a null pointer if there is none. */
+static struct block *swap_device;
+
+/* Slots in use, one bit per slot. */
+static struct bitmap *used_slots;
+static struct lock swap_lock;           /* Protects used_slots. */
+
+/* Sets up swap on the BLOCK_SWAP device.  Without one, every
+   attempt to swap out fails. */
+void
+swap_init (void)
+{
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    {
+      printf ("no swap device--swap disabled\n");
+      used_slots = bitmap_create (0);
+    }
+  else
+    used_slots = bitmap_create (block_size (swap_device) / PAGE_SECTORS);
+  if (used_slots == NULL)
+    PANIC ("couldn't create swap bitmap");
+  lock_init (&swap_lock);
+}
+
+/* Completion function for the writes started by swap_out(). */
+static void
+swap_out_done (void *sema)
+{
+  sema_up (sema);
+}
+
+/* Writes the CNT pages at KPAGES[] to swap, storing the slot
+   that each one went to in the corresponding element of
+   SLOTS[].  The pages go to consecutive slots if possible, and
+   all of the writes are queued before waiting for any of them,
+   so that the disk sees a single sequential run.  Panics if swap
+   is full. */
+void
+swap_out (void *kpages[], size_t slots[], size_t cnt)
+{
+  struct semaphore done;
+  size_t first;
+  size_t i;
+
+  lock_acquire (&swap_lock);
+  first = bitmap_scan_and_flip (used_slots, 0, cnt, false);
+  for (i = 0; i < cnt; i++)
+    {
+      slots[i] = (first != BITMAP_ERROR ? first + i
+                  : bitmap_scan_and_flip (used_slots, 0, 1, false));
+      if (slots[i] == BITMAP_ERROR)
+        PANIC ("out of swap space");
+    }
+  lock_release (&swap_lock);
+
+  sema_init (&done, 0);
+  for (i = 0; i < cnt; i++)
+    block_write_async (swap_device, slots[i] * PAGE_SECTORS, PAGE_SECTORS,
+                       kpages[i], swap_out_done, &done);
+  for (i = 0; i < cnt; i++)
+    sema_down (&done);
+}
+
+/* Reads the page in SLOT into KPAGE and frees SLOT. */
+void
+swap_in (size_t slot, void *kpage)
+{
+  ASSERT (slot != SWAP_NONE);
+
+  block_read_multiple (swap_device, slot * PAGE_SECTORS, PAGE_SECTORS,
+                       kpage);
+  swap_free (slot);
+}
+
+/* Frees SLOT without reading it. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  bitmap_reset (used_slots, slot);
+  lock_release (&swap_lock);
+}
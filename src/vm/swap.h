@@ -0,0 +1,15 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A swap slot holds one page.  SWAP_NONE is not a valid slot. */
+#define SWAP_NONE SIZE_MAX
+
+void swap_init (void);
+void swap_out (void *kpages[], size_t slots[], size_t cnt);
+void swap_in (size_t slot, void *kpage);
+void swap_free (size_t slot);
+
+#endif /* vm/swap.h */